@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <stdalign.h>
+
+#include "arena.h"
+
+// Bytes taken from malloc at a time, larger allocations get a block of their own
+#define ARENA_BLOCK (1024 * 1024)
+
+// Blocks are chained newest first, data follows each header
+typedef struct block
+{
+    struct block *next;
+    size_t used;
+    size_t size;
+    alignas(max_align_t) unsigned char data[];
+} block;
+
+struct arena
+{
+    block *head;
+};
+
+arena *arena_create(void)
+{
+    return calloc(1, sizeof(arena));
+}
+
+void *arena_alloc(arena *pool, size_t size)
+{
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+    block *current = pool->head;
+    if (!current || current->size - current->used < size)
+    {
+        size_t capacity = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        block *fresh = malloc(sizeof(block) + capacity);
+        if (!fresh)
+            return NULL;
+        fresh->used = 0;
+        fresh->size = capacity;
+
+        // An oversized allocation goes behind current block, which keeps serving small ones
+        if (current && capacity > ARENA_BLOCK)
+        {
+            fresh->next = current->next;
+            current->next = fresh;
+        }
+        else
+        {
+            fresh->next = current;
+            pool->head = fresh;
+        }
+        current = fresh;
+    }
+
+    void *memory = current->data + current->used;
+    current->used += size;
+    return memory;
+}
+
+void arena_destroy(arena *pool)
+{
+    if (!pool)
+        return;
+    for (block *current = pool->head, *next; current; current = next)
+    {
+        next = current->next;
+        free(current);
+    }
+    free(pool);
+}
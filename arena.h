@@ -0,0 +1,19 @@
+// Contains declaration of bump allocator holding per scan data, released all at once
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena arena;
+
+// Creates an empty arena, NULL when out of memory
+arena *arena_create(void);
+
+// Carves size bytes aligned for any type out of arena, NULL when out of memory, never thread safe
+void *arena_alloc(arena *pool, size_t size);
+
+// Frees every allocation of arena and arena itself
+void arena_destroy(arena *pool);
+
+#endif
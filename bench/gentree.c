@@ -0,0 +1,340 @@
+// Generates a synthetic tree for benchmarking, same options and seed always give same tree
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <math.h>
+
+// Bytes generated and written at a time
+#define WRITE_BUF (1024 * 1024)
+
+typedef struct options
+{
+    const char *root;
+    long files;
+    int depth;
+    int fanout;
+    long minSize;
+    long maxSize;
+
+    // Fractions of files which are copies of, share a header with, or are hard links to an earlier file
+    double dups;
+    double headers;
+    double links;
+    long headerSize;
+    uint64_t seed;
+} options;
+
+// What a file holds, enough to write it again byte for byte
+typedef struct file
+{
+    long size;
+    uint64_t seed;
+    uint64_t headerSeed;
+    long headerLength;
+    int dir;
+
+    // File whose data this one is, itself unless a hard link
+    long origin;
+} file;
+
+static options opts =
+{
+    .files = 10000,
+    .depth = 4,
+    .fanout = 4,
+    .minSize = 1,
+    .maxSize = 1024 * 1024,
+    .dups = 0.1,
+    .headers = 0.1,
+    .links = 0.01,
+    .headerSize = 4096,
+    .seed = 1
+};
+
+static char **dirs;
+static int ndirs;
+
+static uint64_t state;
+
+// splitmix64, small and good enough to spread sizes and contents
+static uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t next(void)
+{
+    return mix(state += 0x9E3779B97F4A7C15ULL);
+}
+
+static double uniform(void)
+{
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Sizes spread evenly over orders of magnitude, as in real trees where small files dominate
+static long pickSize(void)
+{
+    double low = log((double)opts.minSize), high = log((double)opts.maxSize + 1);
+    long size = (long)exp(low + (high - low) * uniform());
+    return size < opts.minSize ? opts.minSize : size > opts.maxSize ? opts.maxSize : size;
+}
+
+// Fills buffer from a stream of given seed, starting at given offset of stream
+static void fill(unsigned char *buffer, size_t length, uint64_t seed, long offset)
+{
+    uint64_t word = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint64_t position = offset + i;
+        if (i == 0 || position % 8 == 0)
+            word = mix(seed + position / 8 * 0x9E3779B97F4A7C15ULL);
+        buffer[i] = word >> (position % 8 * 8);
+    }
+}
+
+static bool writeFile(const char *path, const file *f, unsigned char *buffer)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    bool success = true;
+    for (long offset = 0; offset < f->size && success;)
+    {
+        long length = f->size - offset < WRITE_BUF ? f->size - offset : WRITE_BUF;
+
+        // Shared header comes from its own stream, rest of file from file's stream
+        long header = offset < f->headerLength ? f->headerLength - offset : 0;
+        header = header < length ? header : length;
+        fill(buffer, header, f->headerSeed, offset);
+        fill(buffer + header, length - header, f->seed, offset + header);
+
+        success = write(fd, buffer, length) == length;
+        offset += length;
+    }
+    if (close(fd) == -1 || !success)
+    {
+        fprintf(stderr, "Unable to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Creates directories level by level, every directory above given depth gets fanout children
+static bool makeDirs(void)
+{
+    long capacity = 1, level = 1;
+    for (int d = 0; d < opts.depth; ++d)
+        capacity += level *= opts.fanout;
+    dirs = malloc(capacity * sizeof(char*));
+    if (!dirs || !(dirs[0] = strdup(opts.root)))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    ndirs = 1;
+    if (mkdir(opts.root, 0755) == -1)
+    {
+        fprintf(stderr, "Unable to create %s: %s\n", opts.root, strerror(errno));
+        return false;
+    }
+
+    for (int start = 0, d = 0; d < opts.depth; ++d)
+    {
+        int end = ndirs;
+        for (int parent = start; parent < end; ++parent)
+        {
+            for (int c = 0; c < opts.fanout; ++c)
+            {
+                char *path = malloc(strlen(dirs[parent]) + 16);
+                if (!path)
+                {
+                    fprintf(stderr, "Not enough memory!\n");
+                    return false;
+                }
+                sprintf(path, "%s/d%d", dirs[parent], c);
+                if (mkdir(path, 0755) == -1)
+                {
+                    fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+                    free(path);
+                    return false;
+                }
+                dirs[ndirs++] = path;
+            }
+        }
+        start = end;
+    }
+    return true;
+}
+
+static void help(void)
+{
+    printf("\n Usage: gentree -o <directory> <options>\n");
+    printf("\n Options:\n\n");
+    printf("\t -o <dir> : directory to create, must not exist\n");
+    printf("\t -n <n> : no of files, defaults to 10000\n");
+    printf("\t --depth <n> : levels of directories below root, defaults to 4\n");
+    printf("\t --fanout <n> : subdirectories of each directory, defaults to 4\n");
+    printf("\t --min-size <bytes>, --max-size <bytes> : bounds of log uniform file sizes, default to 1 and 1 MB\n");
+    printf("\t --dup <ratio> : fraction of files copied from an earlier one, defaults to 0.1\n");
+    printf("\t --header <ratio> : fraction of files of same size and first bytes as an earlier one, but differing\n");
+    printf("\t\t afterwards, defaults to 0.1\n");
+    printf("\t --header-size <bytes> : length of shared headers, defaults to 4096\n");
+    printf("\t --links <ratio> : fraction of files hard linked to an earlier one, defaults to 0.01\n");
+    printf("\t --seed <n> : seed of generated sizes and contents, defaults to 1\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+    enum { OPT_DEPTH = 256, OPT_FANOUT, OPT_MIN_SIZE, OPT_MAX_SIZE, OPT_DUP, OPT_HEADER, OPT_HEADER_SIZE, OPT_LINKS, OPT_SEED };
+    static const struct option options[] =
+    {
+        {"help", no_argument, NULL, 'h'},
+        {"depth", required_argument, NULL, OPT_DEPTH},
+        {"fanout", required_argument, NULL, OPT_FANOUT},
+        {"min-size", required_argument, NULL, OPT_MIN_SIZE},
+        {"max-size", required_argument, NULL, OPT_MAX_SIZE},
+        {"dup", required_argument, NULL, OPT_DUP},
+        {"header", required_argument, NULL, OPT_HEADER},
+        {"header-size", required_argument, NULL, OPT_HEADER_SIZE},
+        {"links", required_argument, NULL, OPT_LINKS},
+        {"seed", required_argument, NULL, OPT_SEED},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ho:n:", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'o': opts.root = optarg;
+                break;
+            case 'n': opts.files = atol(optarg);
+                break;
+            case OPT_DEPTH: opts.depth = atoi(optarg);
+                break;
+            case OPT_FANOUT: opts.fanout = atoi(optarg);
+                break;
+            case OPT_MIN_SIZE: opts.minSize = atol(optarg);
+                break;
+            case OPT_MAX_SIZE: opts.maxSize = atol(optarg);
+                break;
+            case OPT_DUP: opts.dups = atof(optarg);
+                break;
+            case OPT_HEADER: opts.headers = atof(optarg);
+                break;
+            case OPT_HEADER_SIZE: opts.headerSize = atol(optarg);
+                break;
+            case OPT_LINKS: opts.links = atof(optarg);
+                break;
+            case OPT_SEED: opts.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'h': help();
+                return 0;
+            default: help();
+                return -1;
+        }
+    }
+
+    if (!opts.root || opts.files < 1 || opts.depth < 0 || opts.fanout < 1 || opts.minSize < 0 ||
+        opts.maxSize < opts.minSize || opts.dups < 0 || opts.headers < 0 || opts.links < 0 ||
+        opts.dups + opts.headers + opts.links > 1 || opts.headerSize < 1)
+    {
+        fprintf(stderr, "\n Invalid options!\n");
+        help();
+        return -1;
+    }
+    if (opts.minSize == 0)
+        opts.minSize = 1;
+    state = opts.seed;
+
+    file *files = malloc(opts.files * sizeof(file));
+    unsigned char *buffer = malloc(WRITE_BUF);
+    char *path = malloc(4096), *target = malloc(4096);
+    if (!files || !buffer || !path || !target)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return -1;
+    }
+    if (!makeDirs())
+        return -1;
+
+    long dups = 0, headers = 0, links = 0;
+    unsigned long long bytes = 0;
+    for (long i = 0; i < opts.files; ++i)
+    {
+        file *f = &files[i];
+        f->dir = next() % ndirs;
+        snprintf(path, 4096, "%s/f%07ld", dirs[f->dir], i);
+
+        // Every kind of file except a unique one derives from a random earlier file
+        double kind = uniform();
+        const file *earlier = i ? &files[next() % i] : NULL;
+        if (earlier && kind < opts.links)
+        {
+            *f = *earlier;
+            const file *origin = &files[earlier->origin];
+            snprintf(target, 4096, "%s/f%07ld", dirs[origin->dir], earlier->origin);
+            snprintf(path, 4096, "%s/l%07ld", dirs[f->dir], i);
+            if (link(target, path) == -1)
+            {
+                fprintf(stderr, "Unable to link %s: %s\n", path, strerror(errno));
+                return -1;
+            }
+            ++links;
+            continue;
+        }
+        if (earlier && kind < opts.links + opts.dups)
+        {
+            int dir = f->dir;
+            *f = *earlier;
+            f->dir = dir;
+            ++dups;
+        }
+        else if (earlier && kind < opts.links + opts.dups + opts.headers && earlier->size > opts.headerSize)
+        {
+            f->size = earlier->size;
+            f->headerSeed = earlier->headerLength ? earlier->headerSeed : earlier->seed;
+            f->headerLength = opts.headerSize;
+            f->seed = next();
+            ++headers;
+        }
+        else
+        {
+            f->size = pickSize();
+            f->seed = next();
+            f->headerSeed = 0;
+            f->headerLength = 0;
+        }
+        f->origin = i;
+        if (!writeFile(path, f, buffer))
+            return -1;
+        bytes += f->size;
+    }
+
+    printf("{\"files\": %ld, \"dirs\": %d, \"bytes\": %llu, \"dups\": %ld, \"headers\": %ld, \"links\": %ld, \"seed\": %llu}\n",
+           opts.files, ndirs, bytes, dups, headers, links, (unsigned long long)opts.seed);
+
+    for (int i = 0; i < ndirs; ++i)
+        free(dirs[i]);
+    free(dirs);
+    free(files);
+    free(buffer);
+    free(path);
+    free(target);
+    return 0;
+}
@@ -0,0 +1,222 @@
+// Runs a command several times with cold and warm page cache, and writes what each run cost as one JSON line
+
+// GNU extensions, for wait4()
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Cost of one run of command
+typedef struct measure
+{
+    double wall;
+    double user;
+    double sys;
+    long maxrss;
+    int status;
+
+    // Bytes asked for by read calls, and bytes actually fetched from storage
+    long long rchar;
+    long long readBytes;
+} measure;
+
+static double seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Writes back dirty pages and empties page cache, which needs root
+static bool dropCaches(void)
+{
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool dropped = write(fd, "3", 1) == 1;
+    close(fd);
+    return dropped;
+}
+
+// Reads a counter of /proc/<pid>/io, -1 when unknown
+static long long ioCounter(pid_t pid, const char *name)
+{
+    char path[64], key[64];
+    long long value, found = -1;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return -1;
+    while (fscanf(file, "%63[^:]: %lld\n", key, &value) == 2)
+        if (strcmp(key, name) == 0)
+            found = value;
+    fclose(file);
+    return found;
+}
+
+static bool run(char **command, const char *output, measure *m)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        fprintf(stderr, "Unable to start %s: %s\n", command[0], strerror(errno));
+        return false;
+    }
+    if (pid == 0)
+    {
+        int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd != -1)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        execvp(command[0], command);
+        _exit(127);
+    }
+
+    // Child is left a zombie until its io counters are read, they vanish once it is reaped
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1 && errno == EINTR);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    m->rchar = ioCounter(pid, "rchar");
+    m->readBytes = ioCounter(pid, "read_bytes");
+
+    struct rusage usage;
+    while (wait4(pid, &m->status, 0, &usage) == -1 && errno == EINTR);
+    m->wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    m->user = seconds(usage.ru_utime);
+    m->sys = seconds(usage.ru_stime);
+    m->maxrss = usage.ru_maxrss;
+    return true;
+}
+
+// Copies a JSON report written by command into result, joining its lines
+static void embed(FILE *out, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fputs("null", out);
+        return;
+    }
+    for (int c; (c = fgetc(file)) != EOF;)
+        if (c != '\n')
+            fputc(c, out);
+    fclose(file);
+    remove(path);
+}
+
+static void report(FILE *out, const char *label, const char *cache, int iteration, const measure *m, const char *stats)
+{
+    // Label is escaped as a JSON string, control characters are dropped
+    fputs("{\"label\": \"", out);
+    for (const char *c = label; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*c >= 0x20)
+            fputc(*c, out);
+    }
+    fprintf(out, "\", \"cache\": \"%s\", \"iteration\": %d, \"wall_s\": %.4f, \"user_s\": %.4f, "
+                 "\"sys_s\": %.4f, \"max_rss_kb\": %ld, \"rchar\": %lld, \"read_bytes\": %lld, \"exit\": %d",
+            cache, iteration, m->wall, m->user, m->sys, m->maxrss, m->rchar, m->readBytes,
+            WIFEXITED(m->status) ? WEXITSTATUS(m->status) : -1);
+    if (stats)
+    {
+        fputs(", \"stats\": ", out);
+        embed(out, stats);
+    }
+    fputs("}\n", out);
+    fflush(out);
+}
+
+static void help(void)
+{
+    printf("\n Usage: runner <options> -- <command> <arguments>\n");
+    printf("\n Options:\n\n");
+    printf("\t -c <n> : no of runs after dropping page cache, which needs root, defaults to 1\n");
+    printf("\t -w <n> : no of runs with warm page cache, defaults to 3\n");
+    printf("\t -l <label> : label of every result, defaults to command\n");
+    printf("\t -o <file> : appends results to file instead of printing them\n");
+    printf("\t -O <file> : where output of command goes, defaults to /dev/null\n");
+    printf("\t -s <file> : JSON stats command writes to file, like dupsfinder --stats-json, added to every result\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int cold = 1, warm = 3;
+    const char *label = NULL, *results = NULL, *output = "/dev/null", *stats = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hc:w:l:o:O:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': cold = atoi(optarg);
+                break;
+            case 'w': warm = atoi(optarg);
+                break;
+            case 'l': label = optarg;
+                break;
+            case 'o': results = optarg;
+                break;
+            case 'O': output = optarg;
+                break;
+            case 's': stats = optarg;
+                break;
+            case 'h': help();
+                return 0;
+            default: help();
+                return -1;
+        }
+    }
+    if (optind >= argc || cold < 0 || warm < 0)
+    {
+        help();
+        return -1;
+    }
+    char **command = &argv[optind];
+    if (!label)
+        label = command[0];
+
+    FILE *out = results ? fopen(results, "a") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "Unable to open %s: %s\n", results, strerror(errno));
+        return -1;
+    }
+
+    measure m;
+    bool success = true;
+    for (int i = 0; i < cold && success; ++i)
+    {
+        if (!dropCaches())
+        {
+            fprintf(stderr, "Unable to drop page cache, skipping cold runs\n");
+            break;
+        }
+        if ((success = run(command, output, &m)))
+            report(out, label, "cold", i, &m, stats);
+    }
+
+    // First warm run only fills page cache
+    for (int i = 0; i <= warm && success; ++i)
+        if ((success = run(command, output, &m)) && i)
+            report(out, label, "warm", i - 1, &m, stats);
+
+    if (results)
+        fclose(out);
+    return success ? 0 : -1;
+}
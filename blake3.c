@@ -0,0 +1,343 @@
+// Portable BLAKE3, following the reference implementation
+// https://github.com/BLAKE3-team/BLAKE3-specs/blob/master/blake3.pdf
+
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "blake3.h"
+
+#define CHUNK_START 1
+#define CHUNK_END 2
+#define PARENT 4
+#define ROOT 8
+
+// Least bytes worth handing to another thread
+#define PARALLEL_MIN (1024 * 1024)
+
+static const uint32_t IV[8] =
+{
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// Message words used by each round, every round permutes previous one
+static const uint8_t SCHEDULE[7][16] =
+{
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+};
+
+// Whatever is needed to compress a node, kept around so that root can be compressed with ROOT flag
+typedef struct output
+{
+    uint32_t cv[8];
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint64_t counter;
+    uint8_t blockLen;
+    uint8_t flags;
+} output;
+
+static uint32_t load32(const uint8_t *bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void store32(uint8_t *bytes, uint32_t word)
+{
+    bytes[0] = word;
+    bytes[1] = word >> 8;
+    bytes[2] = word >> 16;
+    bytes[3] = word >> 24;
+}
+
+static inline uint32_t rotr(uint32_t word, int bits)
+{
+    return word >> bits | word << (32 - bits);
+}
+
+static inline void g(uint32_t *s, int a, int b, int c, int d, uint32_t x, uint32_t y)
+{
+    s[a] += s[b] + x;
+    s[d] = rotr(s[d] ^ s[a], 16);
+    s[c] += s[d];
+    s[b] = rotr(s[b] ^ s[c], 12);
+    s[a] += s[b] + y;
+    s[d] = rotr(s[d] ^ s[a], 8);
+    s[c] += s[d];
+    s[b] = rotr(s[b] ^ s[c], 7);
+}
+
+static void compress(const uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN], uint64_t counter,
+                     uint8_t blockLen, uint8_t flags, uint32_t out[16])
+{
+    uint32_t m[16], s[16];
+    for (int i = 0; i < 16; ++i)
+        m[i] = load32(block + 4 * i);
+    for (int i = 0; i < 8; ++i)
+        s[i] = cv[i];
+    for (int i = 0; i < 4; ++i)
+        s[8 + i] = IV[i];
+    s[12] = (uint32_t)counter;
+    s[13] = (uint32_t)(counter >> 32);
+    s[14] = blockLen;
+    s[15] = flags;
+
+    for (int round = 0; round < 7; ++round)
+    {
+        const uint8_t *r = SCHEDULE[round];
+        g(s, 0, 4, 8, 12, m[r[0]], m[r[1]]);
+        g(s, 1, 5, 9, 13, m[r[2]], m[r[3]]);
+        g(s, 2, 6, 10, 14, m[r[4]], m[r[5]]);
+        g(s, 3, 7, 11, 15, m[r[6]], m[r[7]]);
+        g(s, 0, 5, 10, 15, m[r[8]], m[r[9]]);
+        g(s, 1, 6, 11, 12, m[r[10]], m[r[11]]);
+        g(s, 2, 7, 8, 13, m[r[12]], m[r[13]]);
+        g(s, 3, 4, 9, 14, m[r[14]], m[r[15]]);
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+static void outputCv(const output *node, uint32_t cv[8])
+{
+    uint32_t out[16];
+    compress(node->cv, node->block, node->counter, node->blockLen, node->flags, out);
+    memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+static void chunkInit(blake3_chunk *chunk, uint64_t counter)
+{
+    memcpy(chunk->cv, IV, sizeof(IV));
+    chunk->counter = counter;
+    memset(chunk->block, 0, sizeof(chunk->block));
+    chunk->blockLen = 0;
+    chunk->blocksCompressed = 0;
+}
+
+static size_t chunkLen(const blake3_chunk *chunk)
+{
+    return (size_t)chunk->blocksCompressed * BLAKE3_BLOCK_LEN + chunk->blockLen;
+}
+
+static void chunkUpdate(blake3_chunk *chunk, const uint8_t *data, size_t size)
+{
+    while (size)
+    {
+        // Last block of a chunk is held back until it is known whether it ends the chunk
+        if (chunk->blockLen == BLAKE3_BLOCK_LEN)
+        {
+            uint32_t out[16];
+            compress(chunk->cv, chunk->block, chunk->counter, BLAKE3_BLOCK_LEN,
+                     chunk->blocksCompressed ? 0 : CHUNK_START, out);
+            memcpy(chunk->cv, out, sizeof(chunk->cv));
+            ++chunk->blocksCompressed;
+            memset(chunk->block, 0, sizeof(chunk->block));
+            chunk->blockLen = 0;
+        }
+
+        size_t take = BLAKE3_BLOCK_LEN - chunk->blockLen;
+        if (take > size)
+            take = size;
+        memcpy(chunk->block + chunk->blockLen, data, take);
+        chunk->blockLen += take;
+        data += take;
+        size -= take;
+    }
+}
+
+static output chunkOutput(const blake3_chunk *chunk)
+{
+    output node;
+    memcpy(node.cv, chunk->cv, sizeof(node.cv));
+    memcpy(node.block, chunk->block, sizeof(node.block));
+    node.counter = chunk->counter;
+    node.blockLen = chunk->blockLen;
+    node.flags = (chunk->blocksCompressed ? 0 : CHUNK_START) | CHUNK_END;
+    return node;
+}
+
+static output parentOutput(const uint32_t left[8], const uint32_t right[8])
+{
+    output node;
+    memcpy(node.cv, IV, sizeof(IV));
+    for (int i = 0; i < 8; ++i)
+    {
+        store32(node.block + 4 * i, left[i]);
+        store32(node.block + 32 + 4 * i, right[i]);
+    }
+    node.counter = 0;
+    node.blockLen = BLAKE3_BLOCK_LEN;
+    node.flags = PARENT;
+    return node;
+}
+
+// Adds chaining value of a complete subtree, total being no of such subtrees up to and including it
+static void pushCv(blake3_hasher *hasher, uint32_t cv[8], uint64_t total)
+{
+    // Every trailing zero bit completes a larger subtree
+    while (!(total & 1))
+    {
+        output parent = parentOutput(hasher->stack[--hasher->depth], cv);
+        outputCv(&parent, cv);
+        total >>= 1;
+    }
+    memcpy(hasher->stack[hasher->depth++], cv, 8 * sizeof(uint32_t));
+}
+
+void blake3_init(blake3_hasher *hasher)
+{
+    chunkInit(&hasher->chunk, 0);
+    hasher->depth = 0;
+}
+
+void blake3_update(blake3_hasher *hasher, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    while (size)
+    {
+        // A full chunk is only known not to be root once more input arrives
+        if (chunkLen(&hasher->chunk) == BLAKE3_CHUNK_LEN)
+        {
+            uint32_t cv[8];
+            output node = chunkOutput(&hasher->chunk);
+            outputCv(&node, cv);
+            uint64_t total = hasher->chunk.counter + 1;
+            pushCv(hasher, cv, total);
+            chunkInit(&hasher->chunk, total);
+        }
+
+        size_t take = BLAKE3_CHUNK_LEN - chunkLen(&hasher->chunk);
+        if (take > size)
+            take = size;
+        chunkUpdate(&hasher->chunk, bytes, take);
+        bytes += take;
+        size -= take;
+    }
+}
+
+// A complete subtree of a power of two chunks, hashed by a helper thread
+typedef struct subtree
+{
+    const uint8_t *data;
+    uint64_t chunks;
+    uint64_t counter;
+    int threads;
+    uint32_t cv[8];
+} subtree;
+
+static void subtreeCv(subtree *tree);
+
+static void *subtreeTask(void *tree)
+{
+    subtreeCv(tree);
+    return NULL;
+}
+
+static void subtreeCv(subtree *tree)
+{
+    if (tree->chunks == 1)
+    {
+        blake3_chunk chunk;
+        chunkInit(&chunk, tree->counter);
+        chunkUpdate(&chunk, tree->data, BLAKE3_CHUNK_LEN);
+        output node = chunkOutput(&chunk);
+        outputCv(&node, tree->cv);
+        return;
+    }
+
+    uint64_t half = tree->chunks / 2;
+    subtree left = {.data = tree->data, .chunks = half, .counter = tree->counter, .threads = tree->threads / 2};
+    subtree right = {.data = tree->data + half * BLAKE3_CHUNK_LEN, .chunks = half, .counter = tree->counter + half,
+                     .threads = tree->threads - tree->threads / 2};
+
+    // Left half goes to a new thread while there are threads to spare, and enough bytes to make it worth it
+    pthread_t helper;
+    bool spawned = left.threads > 0 && half * BLAKE3_CHUNK_LEN >= PARALLEL_MIN &&
+                   pthread_create(&helper, NULL, subtreeTask, &left) == 0;
+    if (!spawned)
+    {
+        left.threads = 1;
+        right.threads = tree->threads;
+        subtreeCv(&left);
+    }
+    subtreeCv(&right);
+    if (spawned)
+        pthread_join(helper, NULL);
+
+    output parent = parentOutput(left.cv, right.cv);
+    outputCv(&parent, tree->cv);
+}
+
+void blake3_update_parallel(blake3_hasher *hasher, const void *data, size_t size, int threads)
+{
+    const uint8_t *bytes = data;
+    if (threads <= 1 || size < 2 * PARALLEL_MIN)
+    {
+        blake3_update(hasher, bytes, size);
+        return;
+    }
+
+    // Completes a partial chunk, so that rest starts on a chunk boundary
+    size_t length = chunkLen(&hasher->chunk);
+    if (length && length < BLAKE3_CHUNK_LEN)
+    {
+        size_t take = BLAKE3_CHUNK_LEN - length;
+        blake3_update(hasher, bytes, take);
+        bytes += take;
+        size -= take;
+    }
+    if (chunkLen(&hasher->chunk) == BLAKE3_CHUNK_LEN)
+    {
+        uint32_t cv[8];
+        output node = chunkOutput(&hasher->chunk);
+        outputCv(&node, cv);
+        pushCv(hasher, cv, hasher->chunk.counter + 1);
+        chunkInit(&hasher->chunk, hasher->chunk.counter + 1);
+    }
+
+    // Largest subtrees aligned to chunks hashed so far, always leaving some input behind as it may hold root
+    uint64_t counter = hasher->chunk.counter;
+    while (size > BLAKE3_CHUNK_LEN)
+    {
+        uint64_t chunks = 1;
+        while (chunks * 2 * BLAKE3_CHUNK_LEN < size)
+            chunks *= 2;
+        while (counter % chunks)
+            chunks /= 2;
+
+        subtree tree = {.data = bytes, .chunks = chunks, .counter = counter, .threads = threads};
+        subtreeCv(&tree);
+        pushCv(hasher, tree.cv, (counter + chunks) / chunks);
+
+        counter += chunks;
+        bytes += chunks * BLAKE3_CHUNK_LEN;
+        size -= chunks * BLAKE3_CHUNK_LEN;
+    }
+    chunkInit(&hasher->chunk, counter);
+    blake3_update(hasher, bytes, size);
+}
+
+void blake3_final(const blake3_hasher *hasher, uint8_t *out)
+{
+    output node = chunkOutput(&hasher->chunk);
+    for (int i = hasher->depth - 1; i >= 0; --i)
+    {
+        uint32_t cv[8];
+        outputCv(&node, cv);
+        node = parentOutput(hasher->stack[i], cv);
+    }
+
+    uint32_t words[16];
+    compress(node.cv, node.block, node.counter, node.blockLen, node.flags | ROOT, words);
+    for (int i = 0; i < 8; ++i)
+        store32(out + 4 * i, words[i]);
+}
@@ -0,0 +1,43 @@
+// Contains declaration of a portable BLAKE3 hasher, able to split large buffers over threads
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+
+// Enough chaining values for 2^54 chunks, more than any file can hold
+#define BLAKE3_MAX_DEPTH 54
+
+typedef struct blake3_chunk
+{
+    uint32_t cv[8];
+    uint64_t counter;
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t blockLen;
+    uint8_t blocksCompressed;
+} blake3_chunk;
+
+typedef struct blake3_hasher
+{
+    blake3_chunk chunk;
+
+    // Chaining values of complete subtrees to the left of current chunk, largest first
+    uint32_t stack[BLAKE3_MAX_DEPTH][8];
+    uint8_t depth;
+} blake3_hasher;
+
+void blake3_init(blake3_hasher *hasher);
+
+void blake3_update(blake3_hasher *hasher, const void *data, size_t size);
+
+// Same as blake3_update(), but hashes independent subtrees of data on up to given no of threads
+void blake3_update_parallel(blake3_hasher *hasher, const void *data, size_t size, int threads);
+
+void blake3_final(const blake3_hasher *hasher, uint8_t *out);
+
+#endif
@@ -0,0 +1,360 @@
+// POSIX.1-2008 + XSI, i.e. SuSv4, features
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+// Bumped whenever layout of records or meaning of digests changes
+#define CACHE_MAGIC "DUPSCACH"
+#define CACHE_VERSION 4
+
+// Entries no run has seen for this many runs are dropped on save
+#define CACHE_RUNS 4
+
+// Which digests an entry holds, an occupied slot keeps IN_USE even when it holds none
+#define HAS_XXHASH 1
+#define HAS_DIGEST 2
+#define IN_USE 4
+
+typedef struct header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+
+    // Partial digests are only valid for the stage chain they were computed with
+    uint64_t stages;
+
+    // Engine which computed whole file digests
+    char engine[16];
+
+    // No of runs which saved cache so far
+    uint64_t runs;
+} header;
+
+// Record as stored on disk, keyed by file identity and checked against size and change times
+typedef struct record
+{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    int64_t ctime;
+    uint32_t flags;
+
+    // No of partial stages whose xxhash is known
+    uint32_t xxstages;
+
+    // Last run which found file
+    uint64_t seen;
+    uint64_t xxhash[MAX_STAGES];
+    unsigned char digest[MAX_DIGEST];
+} record;
+
+// Open addressing table of records, a slot without IN_USE is empty
+static record *entries;
+static size_t capacity;
+static size_t used;
+
+// No of this run, one past the last one saved
+static uint64_t run = 1;
+
+// Bytes table may grow to, 0 for no bound
+static size_t limit;
+
+static size_t slotOf(uint64_t dev, uint64_t ino)
+{
+    uint64_t key = ino * 0x9E3779B97F4A7C15ULL ^ dev * 0xC2B2AE3D27D4EB4FULL;
+    key ^= key >> 29;
+    size_t slot = key & (capacity - 1);
+    while (entries[slot].flags && (entries[slot].dev != dev || entries[slot].ino != ino))
+        slot = (slot + 1) & (capacity - 1);
+    return slot;
+}
+
+// Keeps table at most half full
+static bool reserve(size_t count)
+{
+    if (count * 2 <= capacity)
+        return true;
+    if (count > SIZE_MAX / 2 / sizeof(record))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+
+    size_t size = capacity ? capacity : 1024;
+    while (size < count * 2)
+        size *= 2;
+
+    record *old = entries;
+    size_t oldCapacity = capacity;
+    entries = calloc(size, sizeof(record));
+    if (!entries)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        entries = old;
+        return false;
+    }
+    capacity = size;
+    for (size_t i = 0; i < oldCapacity; ++i)
+        if (old[i].flags)
+            entries[slotOf(old[i].dev, old[i].ino)] = old[i];
+    free(old);
+    return true;
+}
+
+static bool matches(const record *entry, const node *file)
+{
+    return entry->size == file->file_size && entry->mtime == file->mtime && entry->ctime == file->ctime;
+}
+
+bool cache_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return true;
+
+    // Count is checked against size first, so that a torn or damaged cache never sizes table
+    header head;
+    struct stat sb;
+    bool valid = fread(&head, sizeof(head), 1, file) == 1 &&
+                 memcmp(head.magic, CACHE_MAGIC, sizeof(head.magic)) == 0 &&
+                 head.version == CACHE_VERSION && head.recordSize == sizeof(record) &&
+                 fstat(fileno(file), &sb) == 0 && sb.st_size >= (off_t)sizeof(head) &&
+                 head.count == (uint64_t)(sb.st_size - sizeof(head)) / sizeof(record) &&
+                 (sb.st_size - sizeof(head)) % sizeof(record) == 0;
+    if (valid)
+        run = head.runs + 1;
+    if (valid && !reserve(used + head.count))
+    {
+        fclose(file);
+        return false;
+    }
+
+    // Whole file digests survive a change of stage chain and partial ones a change of engine
+    bool sameStages = valid && head.stages == stages_fingerprint(config.stages, config.nstages);
+    bool sameEngine = valid && strncmp(head.engine, config.engine->name, sizeof(head.engine)) == 0;
+    uint32_t kept = (sameStages ? HAS_XXHASH : 0) | (sameEngine ? HAS_DIGEST : 0);
+
+    record entry;
+    for (uint64_t i = 0; valid && i < head.count; ++i)
+    {
+        if (fread(&entry, sizeof(entry), 1, file) != 1)
+        {
+            valid = false;
+            break;
+        }
+        entry.flags &= kept;
+        if (entry.xxstages > MAX_STAGES)
+            entry.flags &= ~HAS_XXHASH;
+        if (!entry.flags)
+            continue;
+        entry.flags |= IN_USE;
+
+        size_t slot = slotOf(entry.dev, entry.ino);
+        if (!entries[slot].flags)
+            ++used;
+        entries[slot] = entry;
+    }
+    fclose(file);
+
+    if (!valid)
+        fprintf(stderr, "Ignoring unreadable hash cache %s\n", path);
+    return true;
+}
+
+bool cache_lookup(const node *file, stream_kind kind, int stage, void *hash)
+{
+    if (!capacity)
+        return false;
+
+    const record *entry = &entries[slotOf(file->dev, file->ino)];
+    if (!entry->flags || !matches(entry, file))
+        return false;
+
+    if (kind == STREAM_XXHASH && (entry->flags & HAS_XXHASH) && (uint32_t)stage < entry->xxstages)
+    {
+        *(unsigned long long *)hash = entry->xxhash[stage];
+        return true;
+    }
+    if (kind == STREAM_DIGEST && (entry->flags & HAS_DIGEST))
+    {
+        memcpy(hash, entry->digest, config.engine->size);
+        return true;
+    }
+    return false;
+}
+
+bool cache_update(const node *file)
+{
+    if (!file->xxstages && !file->hashed && !capacity)
+        return true;
+
+    // A table at its bound takes no more files, which are hashed again next time
+    size_t grown = capacity ? capacity * 2 : 1024;
+    bool full = limit && (used + 1) * 2 > capacity && grown * sizeof(record) > limit;
+    if (!full && !reserve(used + 1))
+        return false;
+    if (!capacity)
+        return true;
+
+    record *entry = &entries[slotOf(file->dev, file->ino)];
+    if (!entry->flags)
+    {
+        // Nothing to remember about a file which was never hashed
+        if (full || (!file->xxstages && !file->hashed))
+            return true;
+        ++used;
+        entry->flags = IN_USE;
+    }
+    else if (!matches(entry, file))
+    {
+        // Digests of a file which changed since they were saved are stale
+        entry->flags = IN_USE;
+    }
+
+    entry->dev = file->dev;
+    entry->ino = file->ino;
+    entry->size = file->file_size;
+    entry->mtime = file->mtime;
+    entry->ctime = file->ctime;
+    entry->seen = run;
+    // Stages a file did not reach this time may still be known from before
+    if (file->xxstages && (!(entry->flags & HAS_XXHASH) || file->xxstages > entry->xxstages))
+    {
+        memcpy(entry->xxhash, nodeXxhash(file), file->xxstages * sizeof(uint64_t));
+        entry->xxstages = file->xxstages;
+        entry->flags |= HAS_XXHASH;
+    }
+    if (file->hashed)
+    {
+        memcpy(entry->digest, nodeDigest(file), config.engine->size);
+        entry->flags |= HAS_DIGEST;
+    }
+    return true;
+}
+
+// Whether an entry is written back, it needs a digest and a run which found its file not long ago
+static bool kept(const record *entry)
+{
+    return (entry->flags & (HAS_XXHASH | HAS_DIGEST)) && entry->seen + CACHE_RUNS > run;
+}
+
+// Creates missing parent directories of path
+static void makeParents(const char *path)
+{
+    char *copy = strdup(path);
+    if (!copy)
+        return;
+    for (char *slash = strchr(copy + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        mkdir(copy, 0755);
+        *slash = '/';
+    }
+    free(copy);
+}
+
+bool cache_save(const char *path)
+{
+    makeParents(path);
+
+    // Written next to cache and renamed over it, so a crash never leaves a torn cache
+    size_t length = strlen(path) + 32;
+    char *temp = malloc(length);
+    if (!temp)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    snprintf(temp, length, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *file = fopen(temp, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Unable to write hash cache %s\n", temp);
+        free(temp);
+        return false;
+    }
+
+    header head;
+    memcpy(head.magic, CACHE_MAGIC, sizeof(head.magic));
+    head.version = CACHE_VERSION;
+    head.recordSize = sizeof(record);
+    head.count = 0;
+    head.stages = stages_fingerprint(config.stages, config.nstages);
+    memset(head.engine, 0, sizeof(head.engine));
+    strncpy(head.engine, config.engine->name, sizeof(head.engine) - 1);
+    head.runs = run;
+    for (size_t i = 0; i < capacity; ++i)
+        if (kept(&entries[i]))
+            ++head.count;
+
+    bool success = fwrite(&head, sizeof(head), 1, file) == 1;
+    for (size_t i = 0; i < capacity && success; ++i)
+    {
+        if (!kept(&entries[i]))
+            continue;
+        record entry = entries[i];
+        entry.flags &= ~IN_USE;
+        success = fwrite(&entry, sizeof(entry), 1, file) == 1;
+    }
+    success = success && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    success = fclose(file) == 0 && success;
+    success = success && rename(temp, path) == 0;
+
+    if (!success)
+    {
+        fprintf(stderr, "Unable to write hash cache %s\n", path);
+        unlink(temp);
+    }
+    else
+    {
+        // Makes rename itself durable
+        char *dir = strdup(path);
+        char *slash = dir ? strrchr(dir, '/') : NULL;
+        if (slash)
+        {
+            *(slash == dir ? slash + 1 : slash) = '\0';
+            int fd = open(dir, O_RDONLY | O_DIRECTORY);
+            if (fd != -1)
+            {
+                fsync(fd);
+                close(fd);
+            }
+        }
+        free(dir);
+    }
+    free(temp);
+    return success;
+}
+
+void cache_limit(size_t bytes)
+{
+    limit = bytes;
+}
+
+size_t cache_memory(void)
+{
+    return capacity * sizeof(record);
+}
+
+void cache_free(void)
+{
+    free(entries);
+    entries = NULL;
+    capacity = 0;
+    used = 0;
+    run = 1;
+    limit = 0;
+}
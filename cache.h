@@ -0,0 +1,33 @@
+// Contains declaration of persistent hash cache which lets rescans skip unchanged files
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "finder.h"
+#include "hashes.h"
+
+// Loads digests saved by an earlier run, a missing or unreadable cache is treated as empty
+bool cache_load(const char *path);
+
+// Copies a cached digest of given kind, and of given partial stage for xxhash, to hash if file has not changed since it was saved
+bool cache_lookup(const node *file, stream_kind kind, int stage, void *hash);
+
+// Records digests of a scanned file, dropping stale ones if file changed
+bool cache_update(const node *file);
+
+// Atomically replaces cache file with current entries
+bool cache_save(const char *path);
+
+// Stops table from growing past given bytes, files found once it is full are not remembered
+void cache_limit(size_t bytes);
+
+// Bytes table of cache takes in memory, which holds it whole
+size_t cache_memory(void);
+
+// Frees cache from memory
+void cache_free(void);
+
+#endif
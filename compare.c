@@ -0,0 +1,186 @@
+// POSIX.1-2008 + XSI, i.e. SuSv4, features
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "compare.h"
+#include "stats.h"
+
+// Whether an open file still has size it was scanned with, a file which grew would otherwise pass as equal to
+// others while its tail is never read
+static bool sameSize(int fd, off_t size)
+{
+    struct stat sb;
+    return fstat(fd, &sb) == 0 && sb.st_size == size;
+}
+
+// Reads exactly length bytes, a file which got shorter since it was scanned counts as unreadable
+static bool readFully(int fd, unsigned char *buffer, size_t length, off_t offset)
+{
+    while (length)
+    {
+        ssize_t bytesRead = pread(fd, buffer, length, offset);
+        if (bytesRead <= 0)
+            return false;
+        stats_read(bytesRead);
+        buffer += bytesRead;
+        offset += bytesRead;
+        length -= bytesRead;
+    }
+    return true;
+}
+
+// Counts files of every class, class numbers never exceed count
+static void countMembers(const unsigned int *classes, size_t count, unsigned int *members)
+{
+    memset(members, 0, (count + 1) * sizeof(unsigned int));
+    for (size_t i = 0; i < count; ++i)
+        if (classes[i])
+            ++members[classes[i]];
+}
+
+int compare_files(char **paths, size_t count, off_t size, unsigned int *classes,
+                  const engine *engine, unsigned char **digests, bool *hashed)
+{
+    int *fds = malloc(count * sizeof(int));
+    unsigned int *next = malloc(count * sizeof(unsigned int));
+    unsigned int *members = malloc((count + 1) * sizeof(unsigned int));
+    unsigned char *buffers = malloc(count * COMPARE_CHUNK);
+    engine_state *states = digests ? aligned_alloc(_Alignof(engine_state), count * sizeof(engine_state)) : NULL;
+    if (!fds || !next || !members || !buffers || (digests && !states))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(fds);
+        free(next);
+        free(members);
+        free(buffers);
+        free(states);
+        return ENOMEM;
+    }
+
+    // Every readable file starts in one class
+    for (size_t i = 0; i < count; ++i)
+    {
+        classes[i] = 1;
+        fds[i] = open(paths[i], O_RDONLY | O_CLOEXEC);
+        stats_open(fds[i] == -1 ? errno : 0);
+        if (fds[i] == -1)
+        {
+            fprintf(stderr, "Unable to open file %s\n", paths[i]);
+            classes[i] = 0;
+        }
+        else if (!sameSize(fds[i], size))
+        {
+            fprintf(stderr, "File %s changed since scan\n", paths[i]);
+            close(fds[i]);
+            fds[i] = -1;
+            classes[i] = 0;
+        }
+        else
+        {
+            posix_fadvise(fds[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        if (digests && digests[i])
+            engine->init(&states[i]);
+    }
+    countMembers(classes, count, members);
+
+    bool running = true;
+    for (off_t offset = 0; offset < size && running; offset += COMPARE_CHUNK)
+    {
+        size_t length = size - offset < COMPARE_CHUNK ? size - offset : COMPARE_CHUNK;
+
+        // Reads next chunk of every file still equal to another one
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!classes[i] || members[classes[i]] < 2)
+                continue;
+            unsigned char *buffer = buffers + i * COMPARE_CHUNK;
+            if (!readFully(fds[i], buffer, length, offset))
+            {
+                stats_error();
+                fprintf(stderr, "Unable to read file %s\n", paths[i]);
+                classes[i] = 0;
+                continue;
+            }
+            if (digests && digests[i])
+                engine->update(&states[i], buffer, length);
+        }
+
+        // Splits every class by chunk just read, a file joins first earlier file of its class with same bytes
+        unsigned int last = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            next[i] = 0;
+            if (!classes[i])
+                continue;
+            if (members[classes[i]] >= 2)
+            {
+                for (size_t j = 0; j < i; ++j)
+                {
+                    if (classes[j] == classes[i] &&
+                        memcmp(buffers + i * COMPARE_CHUNK, buffers + j * COMPARE_CHUNK, length) == 0)
+                    {
+                        next[i] = next[j];
+                        break;
+                    }
+                }
+            }
+            if (!next[i])
+                next[i] = ++last;
+        }
+        memcpy(classes, next, count * sizeof(unsigned int));
+        countMembers(classes, count, members);
+
+        // Files left alone are not read any further
+        running = false;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (fds[i] != -1 && (!classes[i] || members[classes[i]] < 2))
+            {
+                close(fds[i]);
+                fds[i] = -1;
+            }
+            running = running || fds[i] != -1;
+        }
+    }
+
+    // A file may have grown while it was read, in which case what was compared is not all of it
+    bool changed = false;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (fds[i] != -1 && classes[i] && !sameSize(fds[i], size))
+        {
+            fprintf(stderr, "File %s changed since scan\n", paths[i]);
+            classes[i] = 0;
+            changed = true;
+        }
+    }
+    if (changed)
+        countMembers(classes, count, members);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (digests)
+        {
+            hashed[i] = digests[i] && classes[i] && members[classes[i]] >= 2;
+            if (hashed[i])
+                engine->final(&states[i], digests[i]);
+        }
+        if (fds[i] != -1)
+            close(fds[i]);
+    }
+
+    free(fds);
+    free(next);
+    free(members);
+    free(buffers);
+    free(states);
+    return 0;
+}
@@ -0,0 +1,24 @@
+// Contains declaration of lockstep comparison used instead of hashing for small groups
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "hashes.h"
+
+// Bytes read from every file still in the running per round
+#define COMPARE_CHUNK (256 * 1024)
+
+// Reads files of given size side by side and numbers them from 1 so that files of equal content share a number,
+// an unreadable file, or one whose size is no longer given size, gets 0. Files stop being read as soon as they
+// differ from all others. Every file is open at once, so count must stay within descriptors caller can spare.
+// If digests is not NULL, every non NULL digests[i] receives digest of file by engine, and hashed[i] tells whether
+// it was completed, which only happens for files equal to some other one.
+// Returns ENOMEM when out of memory, 0 otherwise.
+int compare_files(char **paths, size_t count, off_t size, unsigned int *classes,
+                  const engine *engine, unsigned char **digests, bool *hashed);
+
+#endif
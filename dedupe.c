@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "dedupe.h"
+#include "stats.h"
+
+// Bytes asked for per call, filesystems clamp longer ranges anyway, btrfs to 16 MB
+#define DEDUPE_CHUNK (16 * 1024 * 1024)
+
+// Files deduplicated against keeper per call, so that request stays within a page as kernel wants
+#define DEDUPE_TARGETS 64
+
+// Drops a target, counting why
+static void drop(int *fd, bool differs, dedupe_result *result)
+{
+    close(*fd);
+    *fd = -1;
+    if (differs)
+        ++result->differ;
+    else
+        ++result->failed;
+}
+
+int dedupe_files(const char *keeper, char **paths, size_t count, off_t size, dedupe_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    if (!count || size == 0)
+        return 0;
+
+    struct file_dedupe_range *range = malloc(sizeof(*range) + DEDUPE_TARGETS * sizeof(struct file_dedupe_range_info));
+    if (!range)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return ENOMEM;
+    }
+
+    int source = open(keeper, O_RDONLY | O_CLOEXEC);
+    stats_open(source == -1 ? errno : 0);
+    if (source == -1)
+    {
+        result->error = errno;
+        result->failed = count;
+        free(range);
+        return 0;
+    }
+
+    // Targets only need to be open for reading as long as caller owns them or may write to them
+    int fds[DEDUPE_TARGETS], owner[DEDUPE_TARGETS];
+    off_t done[DEDUPE_TARGETS];
+    for (size_t first = 0; first < count; first += DEDUPE_TARGETS)
+    {
+        size_t n = count - first < DEDUPE_TARGETS ? count - first : DEDUPE_TARGETS;
+        for (size_t i = 0; i < n; ++i)
+        {
+            fds[i] = open(paths[first + i], O_RDONLY | O_CLOEXEC);
+            stats_open(fds[i] == -1 ? errno : 0);
+            if (fds[i] == -1)
+            {
+                result->error = errno;
+                ++result->failed;
+            }
+        }
+
+        // Kernel may share less than it was asked for and still report range as same, so every target keeps its
+        // own offset, and each call goes on from targets lagging furthest behind until all of them are covered
+        for (size_t i = 0; i < n; ++i)
+            done[i] = 0;
+        while (true)
+        {
+            off_t offset = size;
+            for (size_t i = 0; i < n; ++i)
+                if (fds[i] != -1 && done[i] < offset)
+                    offset = done[i];
+            if (offset == size)
+                break;
+
+            memset(range, 0, sizeof(*range));
+            range->src_offset = offset;
+            range->src_length = size - offset < DEDUPE_CHUNK ? size - offset : DEDUPE_CHUNK;
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (fds[i] == -1 || done[i] != offset)
+                    continue;
+                memset(&range->info[range->dest_count], 0, sizeof(range->info[0]));
+                range->info[range->dest_count].dest_fd = fds[i];
+                range->info[range->dest_count].dest_offset = offset;
+                owner[range->dest_count++] = i;
+            }
+
+            // Whole call fails for reasons shared by every target, like a filesystem without support for it
+            if (ioctl(source, FIDEDUPERANGE, range) == -1)
+            {
+                result->error = errno;
+                stats_error();
+                for (size_t i = 0; i < n; ++i)
+                    if (fds[i] != -1)
+                        drop(&fds[i], false, result);
+                break;
+            }
+            for (int t = 0; t < range->dest_count; ++t)
+            {
+                struct file_dedupe_range_info *info = &range->info[t];
+                if (info->status == FILE_DEDUPE_RANGE_SAME && info->bytes_deduped > 0)
+                {
+                    result->bytes += info->bytes_deduped;
+                    done[owner[t]] += info->bytes_deduped;
+                    continue;
+                }
+
+                // A range reported same with nothing shared would be asked for forever
+                if (info->status < 0)
+                {
+                    result->error = -info->status;
+                    stats_error();
+                }
+                drop(&fds[owner[t]], info->status == FILE_DEDUPE_RANGE_DIFFERS, result);
+            }
+        }
+
+        // Only a file shared over its whole size counts as deduplicated
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (fds[i] == -1)
+                continue;
+            if (done[i] == size)
+                ++result->files;
+            else
+                ++result->failed;
+            close(fds[i]);
+        }
+    }
+
+    close(source);
+    free(range);
+    return 0;
+}
@@ -0,0 +1,28 @@
+// Contains declaration of extent sharing between identical files through FIDEDUPERANGE
+
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// What deduplicating a group achieved
+typedef struct dedupe_result
+{
+    // Bytes kernel reported as now shared, and files sharing all their extents with keeper
+    unsigned long long bytes;
+    unsigned int files;
+
+    // Files kernel found different, like ones changed since scan, and files it could not deduplicate
+    unsigned int differ;
+    unsigned int failed;
+
+    // Last error met, 0 if none
+    int error;
+} dedupe_result;
+
+// Shares extents of keeper with every other path in ranges, kernel compares bytes itself and leaves a range which
+// differs untouched, so a file changed since scan is never corrupted. Returns ENOMEM when out of memory, 0 otherwise.
+int dedupe_files(const char *keeper, char **paths, size_t count, off_t size, dedupe_result *result);
+
+#endif
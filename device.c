@@ -0,0 +1,128 @@
+// GNU extensions, for major() and minor()
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#include "device.h"
+
+// Devices whose kind is remembered, a scan rarely spans more
+#define KNOWN_DEVICES 32
+
+// Reads kept in flight on a spinning disk, just enough for its own queue to reorder them
+#define ROTATIONAL_DEPTH 32
+
+// Bounds of reads kept in flight per thread on other devices, and default when device has no queue
+#define MIN_DEPTH 8
+#define MAX_DEPTH 64
+#define DEFAULT_DEPTH 32
+
+typedef struct known
+{
+    dev_t dev;
+
+    // Whether sysfs knows device, filesystems without a block device, like tmpfs or nfs, have no entry
+    bool block;
+    bool rotational;
+    long requests;
+} known;
+
+static known devices[KNOWN_DEVICES];
+static int ndevices;
+static pthread_mutex_t devicesLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Reads a flag of block queue, a partition has its queue one level up beside its disk
+static bool queueFlag(dev_t dev, const char *name, long *value)
+{
+    char path[128];
+    const char *layouts[] = {"/sys/dev/block/%u:%u/queue/%s", "/sys/dev/block/%u:%u/../queue/%s"};
+    for (int i = 0; i < 2; ++i)
+    {
+        snprintf(path, sizeof(path), layouts[i], major(dev), minor(dev), name);
+        FILE *file = fopen(path, "r");
+        if (!file)
+            continue;
+        bool found = fscanf(file, "%ld", value) == 1;
+        fclose(file);
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+static known describe(dev_t dev)
+{
+    pthread_mutex_lock(&devicesLock);
+    for (int i = 0; i < ndevices; ++i)
+    {
+        if (devices[i].dev == dev)
+        {
+            known device = devices[i];
+            pthread_mutex_unlock(&devicesLock);
+            return device;
+        }
+    }
+    pthread_mutex_unlock(&devicesLock);
+
+    long flag = 0;
+    known device = {dev, queueFlag(dev, "rotational", &flag), flag != 0, 0};
+    if (device.block && !queueFlag(dev, "nr_requests", &device.requests))
+        device.requests = 0;
+
+    pthread_mutex_lock(&devicesLock);
+    if (ndevices < KNOWN_DEVICES)
+        devices[ndevices++] = device;
+    pthread_mutex_unlock(&devicesLock);
+    return device;
+}
+
+bool device_rotational(dev_t dev)
+{
+    return describe(dev).rotational;
+}
+
+device_class device_classify(dev_t dev, int threads)
+{
+    known device = describe(dev);
+    if (!device.block)
+        return (device_class){threads, DEFAULT_DEPTH};
+
+    // Parallel seeks only thrash a spinning disk
+    if (device.rotational)
+    {
+        long depth = device.requests && device.requests < ROTATIONAL_DEPTH ? device.requests : ROTATIONAL_DEPTH;
+        return (device_class){1, depth};
+    }
+
+    // Queue of device is shared by every thread reading it
+    long depth = device.requests ? device.requests / threads : DEFAULT_DEPTH;
+    depth = depth < MIN_DEPTH ? MIN_DEPTH : depth > MAX_DEPTH ? MAX_DEPTH : depth;
+    return (device_class){threads, depth};
+}
+
+bool file_physical(const char *path, unsigned long long *offset)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1)
+        return false;
+
+    // Only first extent is asked for, without syncing, so no data is read or written
+    struct
+    {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request = {.map = {.fm_start = 0, .fm_length = FIEMAP_MAX_OFFSET, .fm_extent_count = 1}};
+
+    bool found = ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents == 1 &&
+                 !(request.extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE));
+    if (found)
+        *offset = request.extent.fe_physical;
+    close(fd);
+    return found;
+}
@@ -0,0 +1,31 @@
+// Contains declaration of queries about block devices and where files lie on them
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// How hard a device may be driven while hashing
+typedef struct device_class
+{
+    // Threads reading from device at once
+    int workers;
+
+    // Reads each of them keeps in flight through io_uring
+    int depth;
+} device_class;
+
+// Whether device holding a file has spinning platters, false when unknown, safe to call from several threads
+bool device_rotational(dev_t dev);
+
+// Picks concurrency for a device out of at most given no of threads, from whether it is rotational and how deep
+// its request queue is. A spinning disk is read by one thread only, a device without a queue, like tmpfs or nfs,
+// by all of them.
+device_class device_classify(dev_t dev, int threads);
+
+// Byte offset on device where file's data starts, false when file has no mapped extent or filesystem
+// cannot tell, as for empty, inline or not yet allocated data
+bool file_physical(const char *path, unsigned long long *offset);
+
+#endif
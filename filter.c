@@ -0,0 +1,145 @@
+#include <regex.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+
+#include "filter.h"
+
+filter_settings filters;
+
+typedef struct rule
+{
+    rule_kind kind;
+    bool regex;
+
+    // Whether rule looks at whole path rather than basename
+    bool wholePath;
+
+    char *glob;
+    regex_t compiled;
+} rule;
+
+static rule *rules;
+static int nrules;
+
+// What rules there are, so that entries are only matched, and paths only built, when some rule needs it
+static bool includes, fileRules, filePaths, dirRules, dirPaths;
+
+bool filter_add(rule_kind kind, const char *pattern, bool regex)
+{
+    rule *grown = realloc(rules, (nrules + 1) * sizeof(rule));
+    if (!grown)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    rules = grown;
+
+    rule *added = &rules[nrules];
+    added->kind = kind;
+    added->regex = regex;
+    added->wholePath = regex || strchr(pattern, '/');
+    added->glob = NULL;
+    if (regex)
+    {
+        int error = regcomp(&added->compiled, pattern, REG_EXTENDED | REG_NOSUB);
+        if (error)
+        {
+            char message[128];
+            regerror(error, &added->compiled, message, sizeof(message));
+            fprintf(stderr, "Invalid regular expression %s: %s\n", pattern, message);
+            return false;
+        }
+    }
+    else if (!(added->glob = strdup(pattern)))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    ++nrules;
+
+    if (kind == RULE_EXCLUDE_DIR)
+    {
+        dirRules = true;
+        dirPaths = dirPaths || added->wholePath;
+    }
+    else
+    {
+        fileRules = true;
+        filePaths = filePaths || added->wholePath;
+        includes = includes || kind == RULE_INCLUDE;
+    }
+    return true;
+}
+
+static bool matches(const rule *tried, const char *name, const char *path)
+{
+    if (tried->regex)
+        return regexec(&tried->compiled, path, 0, NULL, 0) == 0;
+    return fnmatch(tried->glob, tried->wholePath ? path : name, 0) == 0;
+}
+
+// Joins a directory and a name into buffer, falling back to name when path is too long
+static const char *wholePath(const char *dirPath, const char *name, char *buffer)
+{
+    if (!dirPath)
+        return name;
+    size_t length = strlen(dirPath);
+    int written = snprintf(buffer, PATH_MAX, "%s%s%s", dirPath, length && dirPath[length - 1] == '/' ? "" : "/", name);
+    return written > 0 && written < PATH_MAX ? buffer : name;
+}
+
+bool filter_file(const char *dirPath, const char *name, const struct stat *sb)
+{
+    if (sb->st_size < filters.minSize || (filters.maxSize && sb->st_size > filters.maxSize))
+        return false;
+    if (!fileRules)
+        return true;
+
+    char buffer[PATH_MAX];
+    const char *path = filePaths ? wholePath(dirPath, name, buffer) : name;
+
+    // Excludes win over includes
+    bool included = !includes;
+    for (int i = 0; i < nrules; ++i)
+    {
+        if (rules[i].kind == RULE_EXCLUDE_DIR || (rules[i].kind == RULE_INCLUDE && included))
+            continue;
+        if (matches(&rules[i], name, path))
+        {
+            if (rules[i].kind == RULE_EXCLUDE)
+                return false;
+            included = true;
+        }
+    }
+    return included;
+}
+
+bool filter_dir(const char *dirPath, const char *name)
+{
+    if (!dirRules)
+        return true;
+
+    char buffer[PATH_MAX];
+    const char *path = dirPaths ? wholePath(dirPath, name, buffer) : name;
+    for (int i = 0; i < nrules; ++i)
+        if (rules[i].kind == RULE_EXCLUDE_DIR && matches(&rules[i], name, path))
+            return false;
+    return true;
+}
+
+void filter_free(void)
+{
+    for (int i = 0; i < nrules; ++i)
+    {
+        if (rules[i].regex)
+            regfree(&rules[i].compiled);
+        free(rules[i].glob);
+    }
+    free(rules);
+    rules = NULL;
+    nrules = 0;
+    includes = fileRules = filePaths = dirRules = dirPaths = false;
+}
@@ -0,0 +1,45 @@
+// Contains declaration of filters applied while walking, which keep files out of index and prune directories
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Kinds of patterns, a file must match some include if any is given and no exclude, a directory matching an
+// exclude-dir pattern is never read
+typedef enum rule_kind
+{
+    RULE_INCLUDE,
+    RULE_EXCLUDE,
+    RULE_EXCLUDE_DIR
+} rule_kind;
+
+// Filters parsed from command line
+typedef struct filter_settings
+{
+    // Bounds on size of files loaded, maxSize 0 for none
+    off_t minSize;
+    off_t maxSize;
+
+    // Whether walk stays on device of each root, not descending into other filesystems mounted below it
+    bool oneFilesystem;
+} filter_settings;
+
+extern filter_settings filters;
+
+// Adds a glob, matched against basename unless it holds a slash and against whole path then, or an extended
+// regular expression, always matched against whole path. False if expression does not compile or out of memory.
+bool filter_add(rule_kind kind, const char *pattern, bool regex);
+
+// Whether a file found in directory at dirPath is loaded, dirPath is NULL for a root whose name is its whole path
+bool filter_file(const char *dirPath, const char *name, const struct stat *sb);
+
+// Whether a directory found in directory at dirPath is read
+bool filter_dir(const char *dirPath, const char *name);
+
+// Frees compiled patterns
+void filter_free(void);
+
+#endif
@@ -1,31 +1,53 @@
 // POSIX.1-2008 + XSI, i.e. SuSv4, features
 #define _XOPEN_SOURCE 700
 
-#include <ftw.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
-#include <openssl/sha.h>
 
+#include "arena.h"
+#include "cache.h"
+#include "compare.h"
+#include "dedupe.h"
+#include "device.h"
 #include "finder.h"
 #include "hashes.h"
+#include "link.h"
+#include "output.h"
+#include "pool.h"
+#include "progress.h"
+#include "shard.h"
+#include "sizeindex.h"
+#include "spill.h"
 #include "stack.h"
+#include "stats.h"
+#include "uring.h"
+#include "walker.h"
 
-// No of buckets in hashtable
-#define N 65535
+settings config =
+{
+    .threads = 1,
+    .io = IO_AUTO,
+    .stages = {{STAGE_HEAD, 0}, {STAGE_TAIL, 0}, {STAGE_SAMPLE, 8}},
+    .nstages = 3,
+    .compareMax = 4
+};
 
-// Hashtable to store directory's entries
-node* hashtable[N];
+// Reads used by current scan, auto here means io_uring plus mappings for large files
+static io_mode io;
 
 void initialize(void)
 {
-    for (int i = 0; i < N; ++i)
-    {
-        hashtable[i] = NULL;
-    }
+    sizeindex_init();
 }
 
 // Tracks total no of duplicates
@@ -34,276 +56,1808 @@ unsigned int duplicates = 0;
 // Tracks total size taken by duplicates
 off_t dupsSize = 0;
 
+// Tracks total no of paths which are links to a file found under another path
+unsigned int linked = 0;
+
 // Total no of files
-unsigned int no_of_files = 0;
+atomic_uint no_of_files = 0;
+
+// What progress reporter shows, hot paths only store to them and never print
+static atomic_uint checkedFiles, foundDuplicates;
+static _Atomic(const char *) stageName;
+static atomic_ullong stageBytes, stageBase;
 
 static inline void progress(unsigned int processed_files)
 {
-    printf("\r[%u/%u] files checked ||  \b[%u/%u] duplicates found.", processed_files, no_of_files, duplicates, processed_files);
-    fflush(stdout);
+    atomic_store_explicit(&checkedFiles, processed_files, memory_order_relaxed);
+    atomic_store_explicit(&foundDuplicates, duplicates, memory_order_relaxed);
+}
+
+// Starts a stage both in stats and on progress line, with bytes it is expected to read
+static void beginStage(const char *name, unsigned long long filesIn, unsigned long long bytes)
+{
+    stats_begin(name, filesIn);
+    atomic_store(&stageBase, stats_stage_bytes());
+    atomic_store(&stageBytes, bytes);
+    atomic_store(&stageName, name);
+}
+
+static void snapshot(progress_state *state)
+{
+    state->stage = atomic_load(&stageName);
+    state->files = atomic_load(&no_of_files);
+    state->checked = atomic_load_explicit(&checkedFiles, memory_order_relaxed);
+    state->duplicates = atomic_load_explicit(&foundDuplicates, memory_order_relaxed);
+    state->bytesDone = stats_stage_bytes() - atomic_load(&stageBase);
+    state->bytesTotal = atomic_load(&stageBytes);
+}
+
+void startProgress(void)
+{
+    progress_start(snapshot);
+}
+
+void stopProgress(void)
+{
+    // Reads a stage skipped, like rest of files a comparison stopped early on, are not left pending on last line
+    atomic_store(&stageBytes, stats_stage_bytes() - atomic_load(&stageBase));
+    progress_stop();
+}
+
+// Nodes are carved out of an arena of the walker thread loading them, all arenas are released by unload()
+static __thread arena *localArena;
+static arena **arenas;
+static size_t narenas, arenasCapacity;
+static pthread_mutex_t arenasLock = PTHREAD_MUTEX_INITIALIZER;
+
+static arena *threadArena(void)
+{
+    if (localArena)
+        return localArena;
+
+    arena *fresh = arena_create();
+    if (!fresh)
+        return NULL;
+    pthread_mutex_lock(&arenasLock);
+    if (narenas == arenasCapacity)
+    {
+        size_t capacity = arenasCapacity ? arenasCapacity * 2 : 16;
+        arena **grown = realloc(arenas, capacity * sizeof(arena*));
+        if (!grown)
+        {
+            pthread_mutex_unlock(&arenasLock);
+            arena_destroy(fresh);
+            return NULL;
+        }
+        arenas = grown;
+        arenasCapacity = capacity;
+    }
+    arenas[narenas++] = fresh;
+    pthread_mutex_unlock(&arenasLock);
+    return localArena = fresh;
 }
 
-static bool load(const char *path, off_t size)
+// Loads a file into size index, returning its node or NULL when out of memory
+static node *load(arena *pool, const dir *parent, const char *name, const struct stat *sb)
 {
-    // Allocating memory to store file info
-    node* file = malloc(sizeof(node));
+    // Allocating memory to store file info, digests and name in one go
+    size_t length = strlen(name) + 1;
+    size_t digests = config.nstages * sizeof(unsigned long long) + config.engine->size;
+    node* file = pool ? arena_alloc(pool, sizeof(node) + digests + length) : NULL;
     if (!file)
     {
         fprintf(stderr, "Not enough memory to load file!\n");
-        return false;
+        return NULL;
     }
 
     // Storing file info
-    file->file_size = size;
-    file->path = strdup(path);
-    file->xxhash = NULL;
-    file->file_hash = NULL;
+    file->file_size = sb->st_size;
+    file->parent = parent;
+    memcpy(nodeName(file), name, length);
+    file->dev = sb->st_dev;
+    file->ino = sb->st_ino;
+    file->mtime = sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+    file->ctime = sb->st_ctim.tv_sec * 1000000000LL + sb->st_ctim.tv_nsec;
+    file->xxstages = 0;
+    file->hashed = false;
+    file->match = 0;
+    file->alias = NULL;
+    file->isAlias = false;
+    file->location = 0;
+    file->physical = false;
+
+    // Groups file with others of exactly same size
+    return sizeindex_add(file, file->file_size) ? file : NULL;
+}
 
-    // Index in hashtable
-    unsigned int index = file->file_size % N;
+// Directories are interned once, their files only keep a basename
+static void *enterDir(void *parent, const char *name)
+{
+    arena *pool = threadArena();
+    return pool ? dir_add(pool, parent, name) : NULL;
+}
 
-    // File insertion
-    file->next = hashtable[index];
-    hashtable[index] = file;
+static bool fileTree(void *parent, const char *name, const struct stat *sb)
+{
+    atomic_fetch_add(&no_of_files, 1);
+    stats_size(sb->st_size);
 
-    // Success
+    // Under a memory budget files wait on scratch disk until their size comes up
+    if (config.maxMemory)
+        return spill_add(parent, name, sb);
+    if (!load(threadArena(), parent, name, sb))
+    {
+        fprintf(stderr, "Unable to load file %s\n", name);
+        return false;
+    }
     return true;
 }
 
-static int fileTree(const char *fpath, const struct stat *sb, int typeflag, struct FTW *fileinfo)
+char *nodePath(const node *file)
+{
+    return path_build(file->parent, nodeName(file));
+}
+
+bool nodeUnchanged(int fd, const char *name, const node *file, struct stat *sb)
+{
+    return fstatat(fd, name, sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(sb->st_mode) && sb->st_dev == file->dev &&
+           sb->st_ino == file->ino && sb->st_size == file->file_size &&
+           sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec == file->mtime;
+}
+
+bool search(char **dirpaths, int count)
 {
-    if (typeflag == FTW_F)
+    // Walkers never follow symbolic links, under a memory budget files found go to sorted runs instead of index
+    beginStage("walk", 0, 0);
+    bool success = !config.maxMemory || spill_open(config.scratch, config.maxMemory / 2, config.threads);
+    success = success && walk(dirpaths, count, config.threads, enterDir, fileTree);
+    stats_end(atomic_load(&no_of_files));
+    if (success && stats_exhausted())
     {
-        ++no_of_files;
-        if (!load(fpath, sb->st_size))
-        {
-            fprintf(stderr, "Unable to load file at %s\n", fpath);
-            return -1;
-        }
+        fprintf(stderr, "Ran out of file descriptors, raise ulimit -n\n");
+        success = false;
     }
-    else if (typeflag == FTW_DNR)
+    if (!success)
     {
-        fprintf(stderr, "Unable to read %s\n", fpath);
+        fprintf(stderr, "Unable to traverse file tree\n");
+        return false;
     }
-    return 0;
+    return true;
+}
+
+// Indexes being merged, a merged file keeps its shard in top bits of location and its record no in index below
+#define RECORD_BITS 48
+static char **indexes;
+static int nindexes;
+
+// Shard being read, a no standing for its host which goes into top bits of device nos, and prefix of its roots
+static int currentShard;
+static dev_t currentHost;
+static char rootPrefix[80];
+
+// Roots are named after host they were scanned on once shards come from more than one, so that a same path on
+// two hosts stays apart
+static void *enterShardDir(void *parent, const char *name)
+{
+    if (parent || !*rootPrefix)
+        return enterDir(parent, name);
+    char prefixed[sizeof(rootPrefix) + PATH_MAX];
+    snprintf(prefixed, sizeof(prefixed), "%s%s", rootPrefix, name);
+    return enterDir(NULL, prefixed);
 }
 
-bool search(const char* dirpath)
+static bool shardFile(void *parent, const char *name, const struct stat *sb, const unsigned char *digest,
+                      uint64_t record)
 {
-    // Do not follows symbolick link
-    if (nftw(dirpath, fileTree, FOPEN_MAX, FTW_PHYS))
+    char prefixed[sizeof(rootPrefix) + PATH_MAX];
+    if (!parent && *rootPrefix)
     {
-        fprintf(stderr, "Unable to traverse file tree\n");
+        snprintf(prefixed, sizeof(prefixed), "%s%s", rootPrefix, name);
+        name = prefixed;
+    }
+
+    // Device nos only mean something on host which made index, so files of two hosts are never aliases
+    struct stat own = *sb;
+    own.st_dev = currentHost << RECORD_BITS | (sb->st_dev & ((1ULL << RECORD_BITS) - 1));
+    atomic_fetch_add(&no_of_files, 1);
+    stats_size(sb->st_size);
+    node *file = load(threadArena(), parent, name, &own);
+    if (!file)
         return false;
+    file->location = (unsigned long long)currentShard << RECORD_BITS | record;
+    if (digest)
+    {
+        memcpy(nodeDigest(file), digest, config.engine->size);
+        file->hashed = true;
     }
     return true;
 }
 
-static int compxxhash(node *travOut, node *travIn)
+bool merge(char **paths, int count)
 {
-    int resO = 0, resI = 0;
-    
-    // Calculates hash of parent file only if does not exist
-    if (!travOut->xxhash)
+    if (count >= 1 << (64 - RECORD_BITS))
     {
-        travOut->xxhash = malloc(sizeof(unsigned long long));
-        if (!travOut->xxhash)
-        {
-            fprintf(stderr, "Not enough memory!\n");
-            return ENOMEM;    
-        }
-        resO = xxhash_file(travOut->path, travOut->xxhash);
+        fprintf(stderr, "At most %d shard indexes can be merged\n", (1 << (64 - RECORD_BITS)) - 1);
+        return false;
+    }
+    indexes = paths;
+    nindexes = count;
+
+    // Shards of a same host share device nos, so paths reached by two of them still collapse as aliases
+    char (*labels)[64] = malloc(count * sizeof(*labels));
+    bool success = labels != NULL, manyHosts = false;
+    if (!labels)
+        fprintf(stderr, "Not enough memory!\n");
+    for (int i = 0; i < count && success; ++i)
+    {
+        success = shard_label(paths[i], labels[i], sizeof(labels[i]));
+        manyHosts = manyHosts || (success && strcmp(labels[i], labels[0]) != 0);
+    }
+
+    beginStage("merge", 0, 0);
+    for (int i = 0; i < count && success; ++i)
+    {
+        currentShard = i;
+        for (currentHost = 0; strcmp(labels[currentHost], labels[i]) != 0; ++currentHost);
+        rootPrefix[0] = '\0';
+        if (manyHosts)
+            snprintf(rootPrefix, sizeof(rootPrefix), "%s:", labels[i]);
+        success = shard_read(paths[i], enterShardDir, shardFile);
+    }
+    stats_end(atomic_load(&no_of_files));
+    free(labels);
+    if (!success)
+    {
+        fprintf(stderr, "Unable to merge shard indexes\n");
+        return false;
+    }
+    return true;
+}
+
+// No of files a worker hashes through one io_uring, how many stay in flight depends on device
+#define URING_BATCH 512
+
+// Tasks queued per worker of a lane, beyond which its submitter waits for workers to catch up
+#define QUEUE_DEPTH 64
+
+// A run of candidates sharing same size and same digests so far
+typedef struct group
+{
+    size_t start;
+    size_t count;
+    off_t size;
+} group;
+
+// Partial stage being run, every node's xxhash array is indexed by it
+static int currentStage;
+
+// Threads one digest may split its file over, so that files hashed at once never take more than -j between them
+static int digestThreads = 1;
+
+// Where a digest of given kind, of current stage for xxhash, goes in node
+static void *digestOf(node *file, stream_kind kind)
+{
+    return kind == STREAM_DIGEST ? (void *)nodeDigest(file) : (void *)&nodeXxhash(file)[currentStage];
+}
+
+// Marks a digest as computed, or as missing after a failed read
+static void settleDigest(node *file, stream_kind kind, bool computed)
+{
+    if (kind == STREAM_XXHASH)
+    {
+        if (computed)
+            file->xxstages = currentStage + 1;
+    }
+    else
+    {
+        file->hashed = computed;
+    }
+}
+
+static bool hasDigest(const node *file, stream_kind kind)
+{
+    return kind == STREAM_XXHASH ? file->xxstages > currentStage : file->hashed;
+}
+
+// Calculates xxhash of current partial stage only if does not exist, leaves it missing if unreadable
+static int compxxhash(node *file)
+{
+    if (hasDigest(file, STREAM_XXHASH))
+        return 0;
+
+    unsigned long long *hash = digestOf(file, STREAM_XXHASH);
+    char *path = nodePath(file);
+    if (!path)
+        return ENOMEM;
+    settleDigest(file, STREAM_XXHASH, xxhash_file(path, &config.stages[currentStage], file->file_size, hash) == 0);
+    free(path);
+    return 0;
+}
+
+// Calculates digest of whole file only if does not exist, leaves it NULL if unreadable
+static int compdigest(node *file)
+{
+    if (hasDigest(file, STREAM_DIGEST))
+        return 0;
+
+    unsigned char *hash = digestOf(file, STREAM_DIGEST);
+    char *path = nodePath(file);
+    if (!path)
+        return ENOMEM;
+    int result = io == IO_STDIO ? digest_file(path, config.engine, hash)
+                                : digest_mapped(path, config.engine, digestThreads, hash);
+    free(path);
+    settleDigest(file, STREAM_DIGEST, result == 0);
+    return result == ENOMEM ? ENOMEM : 0;
+}
+
+// Slice of a stage's files hashed through one io_uring, or a group compared as a whole
+typedef struct batch
+{
+    // Files hashed through io_uring by their slot in stage's array of files, which tells group they settle
+    node ***slots;
+
+    // Members of a compared group
+    node **members;
+    size_t count;
+    stream_kind kind;
+
+    // Reads kept in flight
+    int depth;
+} batch;
+
+// Hashes a batch with many reads in flight, falls back to stdio if io_uring fails
+static int uringBatch(batch *work)
+{
+    uring_job *jobs = malloc(work->count * sizeof(uring_job));
+    node **owners = malloc(work->count * sizeof(node*));
+    if (!jobs || !owners)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(jobs);
+        free(owners);
+        return ENOMEM;
     }
 
-    // Calculates hash of child file only if does not exist
-    if (!travIn->xxhash)
+    size_t count = 0;
+    int result = 0;
+    for (size_t i = 0; i < work->count; ++i)
     {
-        travIn->xxhash = malloc(sizeof(unsigned long long));
-        if (!travIn->xxhash)
+        node *file = *work->slots[i];
+        if (hasDigest(file, work->kind))
+            continue;
+        void *hash = digestOf(file, work->kind);
+        char *path = nodePath(file);
+        if (!path)
         {
-            fprintf(stderr, "Not enough memory!\n");
-            return ENOMEM;    
+            result = ENOMEM;
+            break;
         }
-        resI = xxhash_file(travIn->path, travIn->xxhash);  
+        jobs[count] = (uring_job){path, work->kind, &config.stages[currentStage], config.engine, file->file_size, hash, 0};
+        owners[count++] = file;
+    }
+
+    bool done = !result && uring_hash(jobs, count, work->depth);
+    for (size_t i = 0; i < count; ++i)
+    {
+        settleDigest(owners[i], work->kind, done && !jobs[i].result);
+        if (!done && !result)
+            result = work->kind == STREAM_XXHASH ? compxxhash(owners[i]) : compdigest(owners[i]);
+        free((char *)jobs[i].path);
     }
 
-    // Comparing the two files, if there hashes are computed, on the basis of sha256 hash 
-    if (!resO && !resI)
+    free(jobs);
+    free(owners);
+    return result;
+}
+
+// Lays out files of every size shared by two or more files as a group, returns no of groups
+static size_t partition(node **files, group *out, unsigned int *processed)
+{
+    size_t kept = 0, write = 0;
+    size_cursor cursor = {0};
+    for (size_group *same; (same = sizeindex_next(&cursor));)
     {
-        if (*travOut->xxhash == *travIn->xxhash)
+        if (same->count < 2)
         {
-            return 0;
+            *processed += same->count;
+            continue;
         }
+        out[kept].start = write;
+        out[kept].count = same->count;
+        out[kept].size = same->size;
+        memcpy(files + write, same->members, same->count * sizeof(node*));
+        write += same->count;
+        ++kept;
+    }
+    progress(*processed);
+    return kept;
+}
+
+// Unreadable files sort last so that they can be dropped from the end of a run
+static int byXxhash(const void *a, const void *b)
+{
+    const node *x = *(node * const *)a, *y = *(node * const *)b;
+    bool hasX = hasDigest(x, STREAM_XXHASH), hasY = hasDigest(y, STREAM_XXHASH);
+    if (!hasX || !hasY)
+        return (!hasX) - (!hasY);
+    unsigned long long hx = nodeXxhash(x)[currentStage], hy = nodeXxhash(y)[currentStage];
+    return (hx > hy) - (hx < hy);
+}
+
+// Compared files are told apart by their class and hashed ones by digest, a group only ever holds one sort
+static int byContent(const void *a, const void *b)
+{
+    const node *x = *(node * const *)a, *y = *(node * const *)b;
+    if (x->match || y->match)
+    {
+        if (!x->match || !y->match)
+            return (!x->match) - (!y->match);
+        return (x->match > y->match) - (x->match < y->match);
     }
-    return -1;
+    if (!x->hashed || !y->hashed)
+        return (!x->hashed) - (!y->hashed);
+    return memcmp(nodeDigest(x), nodeDigest(y), config.engine->size);
+}
+
+static int byPath(const void *a, const void *b)
+{
+    const node *x = *(node * const *)a, *y = *(node * const *)b;
+    return path_compare(x->parent, nodeName(x), y->parent, nodeName(y));
 }
 
-static int compsha256(node * travOut, node *travIn)
+// Brings paths of a same inode together, first path in order coming first
+static int byInode(const void *a, const void *b)
 {
-    int resO = 0, resI = 0; 
+    const node *x = *(node * const *)a, *y = *(node * const *)b;
+    if (x->dev != y->dev)
+        return (x->dev > y->dev) - (x->dev < y->dev);
+    if (x->ino != y->ino)
+        return (x->ino > y->ino) - (x->ino < y->ino);
+    return path_compare(x->parent, nodeName(x), y->parent, nodeName(y));
+}
 
-    // Calculates hash of parent file only if does not exist
-    if (!travOut->file_hash)
+// Keeps one path of every inode in each group and hangs others off it as aliases, a path found twice through
+// overlapping roots is dropped altogether. Groups left with a single inode are not kept, returns no of groups kept.
+static size_t collapse(node **files, const group *groups, size_t count, group *out, unsigned int *processed)
+{
+    size_t kept = 0, write = 0;
+    for (size_t g = 0; g < count; ++g)
     {
-        travOut->file_hash = malloc(SHA256_DIGEST_LENGTH);
-        if (!travOut->file_hash)
+        node **members = files + groups[g].start;
+        size_t size = groups[g].count, start = write;
+        qsort(members, size, sizeof(node*), byInode);
+
+        node *last = NULL, **tail = NULL;
+        for (size_t i = 0; i < size; ++i)
         {
-            fprintf(stderr, "Not enough memory!\n");
-            return ENOMEM;
+            node *file = members[i];
+            if (last && last->dev == file->dev && last->ino == file->ino)
+            {
+                // Same path reached through overlapping roots tells nothing new
+                if (path_compare(last->parent, nodeName(last), file->parent, nodeName(file)) != 0)
+                {
+                    *tail = file;
+                    tail = &file->alias;
+                    file->isAlias = true;
+                    ++linked;
+                }
+                last = file;
+                ++*processed;
+                continue;
+            }
+
+            // Write never passes read position
+            files[write++] = file;
+            last = file;
+            tail = &file->alias;
+        }
+
+        if (write - start < 2)
+        {
+            *processed += write - start;
+            write = start;
+            continue;
         }
-        resO = sha256_file(travOut->path, travOut->file_hash);
-        if (resO == ENOMEM)
-            return ENOMEM;
+        out[kept].start = start;
+        out[kept].count = write - start;
+        out[kept].size = groups[g].size;
+        ++kept;
     }
+    return kept;
+}
 
-    // Calculates hash of child file only if does not exist
-    if (!travIn->file_hash)
+// Splits every group into runs of files equal under cmp and keeps runs of two or more files in out, returns no of groups kept
+static size_t refine(node **files, const group *groups, size_t count, group *out, int (*cmp)(const void *, const void *), bool (*valid)(const node *), unsigned int *processed)
+{
+    size_t kept = 0, write = 0;
+    for (size_t g = 0; g < count; ++g)
     {
-        travIn->file_hash = malloc(SHA256_DIGEST_LENGTH);
-        if (!travIn->file_hash)
+        node **members = files + groups[g].start;
+        size_t size = groups[g].count;
+        qsort(members, size, sizeof(node*), cmp);
+
+        for (size_t i = 0, j; i < size; i = j)
         {
-            fprintf(stderr, "Not enough memory!\n");
-            return ENOMEM;
+            for (j = i + 1; j < size && cmp(&members[i], &members[j]) == 0; ++j);
+
+            if (j - i < 2 || !valid(members[i]))
+            {
+                *processed += j - i;
+                continue;
+            }
+
+            // Moves the run down, write never passes read position
+            memmove(files + write, members + i, (j - i) * sizeof(node*));
+            out[kept].start = write;
+            out[kept].count = j - i;
+            out[kept].size = members[i]->file_size;
+            write += j - i;
+            ++kept;
         }
-        resI = sha256_file(travIn->path, travIn->file_hash);      
-        if (resI == ENOMEM)
-            return ENOMEM; 
+        progress(*processed);
+    }
+    return kept;
+}
+
+static bool hasXxhash(const node *file)
+{
+    return hasDigest(file, STREAM_XXHASH);
+}
+
+static bool hasContent(const node *file)
+{
+    return file->match || file->hashed;
+}
+
+// A group of digest stage, written out by whichever task settles its last file
+typedef struct settling
+{
+    size_t start;
+    size_t count;
+
+    // Tasks left which hash or compare its files
+    atomic_size_t pending;
+} settling;
+
+// Groups of digest stage by start in its array of files, NULL unless a format writes groups as they settle
+static settling *settlings;
+static size_t nsettlings;
+static node **stageFiles;
+
+// Set once groups of a check were written as they settled, so that report() does not write them again
+static bool streamed;
+
+// Set when a group could not be written
+static atomic_bool outputFailed;
+
+// Group a slot of stage's array of files lies in
+static settling *settlingOf(node **slot)
+{
+    size_t position = slot - stageFiles, low = 0, high = nsettlings;
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (settlings[middle].start <= position)
+            low = middle;
+        else
+            high = middle;
     }
+    return &settlings[low];
+}
 
-    // Comparing the two files, if there hashes are computed, on the basis of sha256 hash 
-    if (!resO && !resI)
+// Writes runs of same content of a group every file of which is settled, same runs refine() finds later on
+static void writeSettled(node **members, size_t count)
+{
+    qsort(members, count, sizeof(node*), byContent);
+    for (size_t i = 0, j; i < count; i = j)
     {
-        if (memcmp(travOut->file_hash, travIn->file_hash, SHA256_DIGEST_LENGTH) == 0)
-            return 0;
+        for (j = i + 1; j < count && byContent(&members[i], &members[j]) == 0; ++j);
+        if (j - i < 2 || !hasContent(members[i]))
+            continue;
+        qsort(members + i, j - i, sizeof(node*), byPath);
+        if (!output_group(members + i, j - i, members[i]->hashed ? nodeDigest(members[i]) : NULL))
+            atomic_store(&outputFailed, true);
     }
-    return -1;
 }
 
-bool check(void)
+// Counts a task of a group as done, last one writes group out
+static void finished(node **slot)
 {
-    // Pointers to traverse through the linked list
-    node *travOut = NULL, *travIn = NULL;
+    if (!settlings)
+        return;
+    settling *group = settlingOf(slot);
+    if (atomic_fetch_sub(&group->pending, 1) == 1)
+        writeSettled(stageFiles + group->start, group->count);
+}
 
-    int result = -1;
+// Set by hashing tasks when they run out of memory
+static atomic_bool outOfMemory;
 
-    unsigned int processed_files = 0;
+static void xxhashTask(void *slot)
+{
+    if (compxxhash(*(node **)slot) == ENOMEM)
+        atomic_store(&outOfMemory, true);
+}
+
+static void digestTask(void *slot)
+{
+    if (compdigest(*(node **)slot) == ENOMEM)
+        atomic_store(&outOfMemory, true);
+    finished(slot);
+}
+
+static void uringTask(void *arg)
+{
+    batch *work = arg;
+    if (uringBatch(work) == ENOMEM)
+        atomic_store(&outOfMemory, true);
+    for (size_t i = 0; i < work->count; ++i)
+        finished(work->slots[i]);
+}
+
+// Compares a whole group byte by byte, also hashing files without a digest for cache's sake
+static int compareGroup(batch *work)
+{
+    char **paths = calloc(work->count, sizeof(char*));
+    unsigned int *classes = malloc(work->count * sizeof(unsigned int));
+    unsigned char **digests = config.cache ? calloc(work->count, sizeof(unsigned char*)) : NULL;
+    bool *hashed = malloc(work->count * sizeof(bool));
+    int result = 0;
+    if (!paths || !classes || !hashed || (config.cache && !digests))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        result = ENOMEM;
+    }
 
-    for (int i = 0; i < N; ++i)
+    for (size_t i = 0; i < work->count && !result; ++i)
     {
-        if (hashtable[i])
+        if (!(paths[i] = nodePath(work->members[i])))
         {
-            // Checking
-            travOut = hashtable[i];
+            result = ENOMEM;
+            break;
+        }
+        if (digests && !hasDigest(work->members[i], STREAM_DIGEST))
+            digests[i] = digestOf(work->members[i], STREAM_DIGEST);
+    }
 
-            // Till the end of linked list
-            while(travOut)
-            {
-                progress(++processed_files);
+    if (!result)
+        result = compare_files(paths, work->count, work->members[0]->file_size, classes, config.engine, digests, hashed);
+    for (size_t i = 0; i < work->count && digests; ++i)
+        if (digests[i])
+            settleDigest(work->members[i], STREAM_DIGEST, !result && hashed[i]);
+    for (size_t i = 0; i < work->count && !result; ++i)
+        work->members[i]->match = classes[i];
 
-                bool isDup = false;
+    for (size_t i = 0; i < work->count && paths; ++i)
+        free(paths[i]);
+    free(paths);
+    free(classes);
+    free(digests);
+    free(hashed);
+    return result;
+}
 
-                // To traverse remaining nodes in linked list
-                travIn = travOut->next;
+static void compareTask(void *arg)
+{
+    batch *work = arg;
+    if (compareGroup(work) == ENOMEM)
+        atomic_store(&outOfMemory, true);
+    finished(work->members);
+}
 
-                // Until end of list
-                while(travIn)
-                {
-                    // Groups files on the basis of file size
-                    if (travOut->file_size == travIn->file_size && travOut->file_size != -1 && travIn->file_size != -1)
-                    {
-                        if ((result = compxxhash(travOut, travIn)) == 0)
-                        {
-                            if ((result = compsha256(travOut, travIn)) == 0)
-                            {
-                                isDup = true;
-                                push(travIn, false);
-                                ++duplicates;
-                                dupsSize += travIn->file_size;
-
-                                // Removing duplicate file from comparison
-                                travIn->file_size = -1;
-                            }
-                            else if (result == ENOMEM)
-                            {
-                                return false;
-                            }
-                        }
-                        else if (result == ENOMEM)
-                        {
-                            return false;
-                        }
-                    }
+// Groups holding most bytes come first so that biggest jobs do not trail at the end
+static int byWeight(const void *a, const void *b)
+{
+    const group *x = a, *y = b;
+    double wx = (double)x->size * x->count, wy = (double)y->size * y->count;
+    return (wy > wx) - (wy < wx);
+}
 
-                    // Moves to next node on list
-                    travIn = travIn->next;
-                }
-                
-                if (isDup)
-                    push(travOut, true);
+// Restores array order of groups, which refine() relies upon to compact runs in place
+static int byStart(const void *a, const void *b)
+{
+    const group *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
 
-                // Moves to next node
-                travOut = travOut->next;
-            }
-        }
-    }
-    return true;
+// Orders slots of files by device, then files of known physical offset by it, then the rest by inode
+static int byLocation(const void *a, const void *b)
+{
+    const node *x = **(node **const *)a, *y = **(node **const *)b;
+    if (x->dev != y->dev)
+        return (x->dev > y->dev) - (x->dev < y->dev);
+    if (x->physical != y->physical)
+        return y->physical - x->physical;
+    return (x->location > y->location) - (x->location < y->location);
+}
+
+// Order reads of current scan follow, auto is settled by settleOrder()
+static order_mode order;
+
+// Sweeps by location when asked to, or by default when any candidate lies on a rotational device
+static order_mode settleOrder(node **files, group *groups, size_t count)
+{
+    if (config.order != ORDER_AUTO)
+        return config.order;
+    for (size_t g = 0; g < count; ++g)
+        if (device_rotational(files[groups[g].start]->dev))
+            return ORDER_DISK;
+    return ORDER_NONE;
 }
 
-void deleteAll(void)
+// Finds where a file lies once, right before it is first read, files served by cache never need it
+static void locate(node *file)
 {
-    stack *trav = NULL, *temp = NULL;
-    trav = top;
-    while(trav)
+    if (file->location)
+        return;
+    file->location = file->ino;
+    if (order == ORDER_DISK)
     {
-        temp = trav;
-        trav = trav->next;
-        if (!temp->isParent)
-            if (remove(temp->file->path) == -1)
-            {
-                fprintf(stderr, "\nUnable to remove file %s\n", temp->file->path);
-                fprintf(stderr, "Error: %s\n", strerror(errno));
-            }
-        pop();
+        char *path = nodePath(file);
+        file->physical = path && file_physical(path, &file->location);
+        if (!file->physical)
+            file->location = file->ino;
+        free(path);
     }
-    top = NULL;
-    printf("\n\nDeleted all duplicate files!\n\n");
 }
 
-bool unload(void)
+// Fills digest without reading file when it is already known, returns false if file has to be read
+static bool withoutReading(node *file, stream_kind kind)
+{
+    if (hasDigest(file, kind))
+        return true;
+
+    // Every stage reads whole of a file no bigger than a block, first one already told all
+    bool repeat = kind == STREAM_XXHASH && currentStage > 0 && file->file_size <= STAGE_BLOCK;
+
+    unsigned char hash[MAX_DIGEST];
+    if (!repeat && !(config.cache && cache_lookup(file, kind, currentStage, hash)))
+        return false;
+
+    void *digest = digestOf(file, kind);
+    if (repeat)
+        memset(digest, 0, sizeof(unsigned long long));
+    else
+        memcpy(digest, hash, kind == STREAM_XXHASH ? sizeof(unsigned long long) : config.engine->size);
+    settleDigest(file, kind, true);
+    return true;
+}
+
+// Tells whether a file is hashed in an io_uring batch or by a task of its own
+static bool viaUring(const node *file, stream_kind kind)
+{
+    if (io == IO_URING)
+        return true;
+    if (io != IO_AUTO)
+        return false;
+
+    // Large files are hashed from a mapping instead, which saves copying them
+    return kind == STREAM_XXHASH || file->file_size < MAP_THRESHOLD;
+}
+
+// Descriptors kept free for other reads of workers, stdio and io_uring
+#define FD_RESERVE 64
+
+// Largest group compared byte by byte, which holds a descriptor for every member on every worker comparing at
+// once, so larger groups are hashed instead once descriptors would run out
+static size_t compareLimit;
+
+// Tells whether a group is compared byte by byte, which is not needed when every digest is already known
+static bool compared(node **members, size_t count, stream_kind kind)
 {
-    // Pointer to trav linked lists in hashtable
-    node* trav = NULL;
+    if (kind != STREAM_DIGEST || count > compareLimit)
+        return false;
+
+    bool known = true;
+    for (size_t i = 0; i < count; ++i)
+        known = withoutReading(members[i], kind) && known;
+    return !known;
+}
+
+// Work of a stage, lined up on main thread, whose every array keeps work of a device together so that a lane's
+// share of it is a range of each
+typedef struct plan
+{
+    task_fn fn;
+
+    // Groups compared as a whole, in scheduling order
+    batch *compared;
+    size_t ncompared;
+
+    // Slots of files hashed by a task of their own, in scheduling order
+    node ***direct;
+    size_t ndirect;
+
+    // Files hashed through io_uring, no batch mixes devices
+    batch *batches;
+    size_t nbatches;
+} plan;
 
-    // Pointer to hold the node to be freed
-    node* temp = NULL;  
+// Files of each device are hashed on a pool of their own, sized to what device sustains and fed by a submitter
+// thread of its own, so that a slow disk never holds up faster ones and is not thrashed by parallel seeks
+typedef struct lane
+{
+    dev_t dev;
+    device_class class;
+    pool *workers;
+
+    // Share of stage lane is fed, worked out before any task runs, as a settled group may reorder its slots
+    plan share;
+    pthread_t submitter;
+} lane;
+
+static lane *lanes;
+static size_t nlanes;
+
+static lane *laneOf(dev_t dev)
+{
+    for (size_t i = 0; i < nlanes; ++i)
+        if (lanes[i].dev == dev)
+            return &lanes[i];
+    return NULL;
+}
 
-    for (int i = 0; i < N; ++i)
-    {   
-        trav = hashtable[i];
-        while(trav)
+// Opens a lane for every device holding a candidate, returns false when out of memory
+static bool openLanes(node **files, group *groups, size_t count)
+{
+    size_t capacity = 0;
+    for (size_t g = 0; g < count; ++g)
+    {
+        for (size_t i = 0; i < groups[g].count; ++i)
         {
-            temp = trav;
-            trav = trav->next;
-            free(temp->file_hash);
-            free(temp->path);
-            free(temp->xxhash);
-            free(temp);
+            dev_t dev = files[groups[g].start + i]->dev;
+            lane *owner = laneOf(dev);
+            if (!owner)
+            {
+                if (nlanes == capacity)
+                {
+                    capacity = capacity ? capacity * 2 : 4;
+                    lane *grown = realloc(lanes, capacity * sizeof(lane));
+                    if (!grown)
+                    {
+                        fprintf(stderr, "Not enough memory!\n");
+                        return false;
+                    }
+                    lanes = grown;
+                }
+                owner = &lanes[nlanes++];
+                *owner = (lane){dev, device_classify(dev, config.threads), NULL, {0}, 0};
+            }
         }
-        hashtable[i] = NULL;
     }
 
+    size_t workers = 0;
+    for (size_t i = 0; i < nlanes; ++i)
+    {
+        lanes[i].workers = pool_create(lanes[i].class.workers, (size_t)lanes[i].class.workers * QUEUE_DEPTH);
+        if (!lanes[i].workers)
+            return false;
+        workers += lanes[i].class.workers;
+    }
+
+    struct rlimit limit;
+    compareLimit = config.compareMax;
+    if (workers && getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        size_t spare = limit.rlim_cur > FD_RESERVE ? (limit.rlim_cur - FD_RESERVE) / workers : 0;
+        if (spare < compareLimit)
+            compareLimit = spare;
+
+        // Every read an io_uring keeps in flight holds a descriptor as well
+        for (size_t i = 0; i < nlanes; ++i)
+            if ((size_t)lanes[i].class.depth > spare)
+                lanes[i].class.depth = spare ? (int)spare : 1;
+    }
     return true;
 }
 
-unsigned int getDuplicates(void)
+static void closeLanes(void)
 {
-    return duplicates;
+    for (size_t i = 0; i < nlanes; ++i)
+        if (lanes[i].workers)
+            pool_destroy(lanes[i].workers);
+    free(lanes);
+    lanes = NULL;
+    nlanes = 0;
+}
+
+// Gathers slots of files of each device together, otherwise keeping their order, returns false when out of memory
+static bool byLane(node ***lined, size_t count)
+{
+    if (nlanes < 2)
+        return true;
+
+    node ***spare = malloc(count * sizeof(node**));
+    if (!spare)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    size_t write = 0;
+    for (size_t l = 0; l < nlanes; ++l)
+        for (size_t i = 0; i < count; ++i)
+            if ((*lined[i])->dev == lanes[l].dev)
+                spare[write++] = lined[i];
+    memcpy(lined, spare, count * sizeof(node**));
+    free(spare);
+    return true;
+}
+
+// Same for groups compared as a whole, each going to lane of its first file
+static bool comparedByLane(batch *compared, size_t count)
+{
+    if (nlanes < 2 || !count)
+        return true;
+
+    batch *spare = malloc(count * sizeof(batch));
+    if (!spare)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    size_t write = 0;
+    for (size_t l = 0; l < nlanes; ++l)
+        for (size_t i = 0; i < count; ++i)
+            if (compared[i].members[0]->dev == lanes[l].dev)
+                spare[write++] = compared[i];
+    memcpy(compared, spare, count * sizeof(batch));
+    free(spare);
+    return true;
+}
+
+// Hands every lane its range of each array of a plan
+static void share(const plan *work)
+{
+    for (size_t i = 0; i < nlanes; ++i)
+        lanes[i].share = (plan){work->fn, NULL, 0, NULL, 0, NULL, 0};
+    for (size_t i = 0; i < work->ncompared; ++i)
+    {
+        plan *part = &laneOf(work->compared[i].members[0]->dev)->share;
+        if (!part->ncompared++)
+            part->compared = &work->compared[i];
+    }
+    for (size_t i = 0; i < work->ndirect; ++i)
+    {
+        plan *part = &laneOf((*work->direct[i])->dev)->share;
+        if (!part->ndirect++)
+            part->direct = &work->direct[i];
+    }
+    for (size_t i = 0; i < work->nbatches; ++i)
+    {
+        plan *part = &laneOf((*work->batches[i].slots[0])->dev)->share;
+        if (!part->nbatches++)
+            part->batches = &work->batches[i];
+    }
+}
+
+// Queues lane's share of a stage, waiting only on its own queue, then waits for its workers
+static void *feedLane(void *arg)
+{
+    lane *owner = arg;
+    const plan *part = &owner->share;
+    for (size_t i = 0; i < part->ncompared && !atomic_load(&outOfMemory); ++i)
+        pool_submit(owner->workers, compareTask, &part->compared[i]);
+    for (size_t i = 0; i < part->ndirect && !atomic_load(&outOfMemory); ++i)
+        pool_submit(owner->workers, part->fn, part->direct[i]);
+    for (size_t i = 0; i < part->nbatches && !atomic_load(&outOfMemory); ++i)
+        pool_submit(owner->workers, uringTask, &part->batches[i]);
+    pool_wait(owner->workers);
+    return NULL;
+}
+
+// Hashes every file of every group on pool of its device, returns false if any task ran out of memory
+static bool hashStage(node **files, group *groups, size_t count, stream_kind kind)
+{
+    // A format writing groups one by one gets each as soon as it settles, so that a reader can act on it while
+    // scan goes on, groups are still in order of their start here
+    streamed = kind == STREAM_DIGEST && config.format != OUTPUT_TEXT;
+    if (streamed && count)
+    {
+        if (!(settlings = malloc(count * sizeof(settling))))
+        {
+            fprintf(stderr, "Not enough memory!\n");
+            return false;
+        }
+        for (size_t g = 0; g < count; ++g)
+        {
+            settlings[g].start = groups[g].start;
+            settlings[g].count = groups[g].count;
+            atomic_init(&settlings[g].pending, 0);
+        }
+        nsettlings = count;
+        stageFiles = files;
+    }
+
+    qsort(groups, count, sizeof(group), byWeight);
+
+    size_t total = 0;
+    for (size_t g = 0; g < count; ++g)
+        total += groups[g].count;
+    digestThreads = total && total < (size_t)config.threads ? config.threads / total : 1;
+
+    // Slots of files hashed through io_uring are lined up in scheduling order and cut into batches, one ring
+    // each, files hashed by tasks of their own are lined up from end of same array, and groups compared as a
+    // whole follow batches
+    node ***lined = malloc(total * sizeof(node**));
+    batch *batches = malloc((total / URING_BATCH + nlanes + count) * sizeof(batch));
+    if (!lined || !batches)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        atomic_store(&outOfMemory, true);
+    }
+
+    size_t queued = 0, direct = 0, spare = total / URING_BATCH + nlanes, planned = lined && batches ? count : 0;
+    plan work = {kind == STREAM_XXHASH ? xxhashTask : digestTask, batches + spare, 0, NULL, 0, batches, 0};
+    for (size_t g = 0; g < planned; ++g)
+    {
+        node **members = files + groups[g].start;
+        size_t pending = 0;
+        if (compared(members, groups[g].count, kind))
+        {
+            work.compared[work.ncompared++] = (batch){NULL, members, groups[g].count, kind, 0};
+            pending = 1;
+        }
+        else
+        {
+            for (size_t i = 0; i < groups[g].count; ++i)
+            {
+                if (withoutReading(members[i], kind))
+                    continue;
+                ++pending;
+                if (order != ORDER_NONE)
+                    locate(members[i]);
+                if (viaUring(members[i], kind))
+                    lined[queued++] = &members[i];
+                else
+                    lined[total - ++direct] = &members[i];
+            }
+        }
+
+        // A group whose every digest is known already is written right away
+        if (settlings)
+        {
+            atomic_store(&settlingOf(members)->pending, pending);
+            if (!pending)
+                writeSettled(members, groups[g].count);
+        }
+    }
+    work.direct = lined + total - direct;
+    work.ndirect = direct;
+
+    // Sorting by location also keeps files of a device together, as batches must never mix devices
+    if (order != ORDER_NONE)
+    {
+        qsort(lined, queued, sizeof(node**), byLocation);
+        qsort(work.direct, direct, sizeof(node**), byLocation);
+    }
+    else
+    {
+        // Files were lined up backwards from end
+        for (size_t i = 0; i < direct / 2; ++i)
+        {
+            node **swapped = work.direct[i];
+            work.direct[i] = work.direct[direct - 1 - i];
+            work.direct[direct - 1 - i] = swapped;
+        }
+        if (!byLane(lined, queued) || !byLane(work.direct, direct))
+            atomic_store(&outOfMemory, true);
+    }
+    if (!comparedByLane(work.compared, work.ncompared))
+        atomic_store(&outOfMemory, true);
+
+    for (size_t i = 0, j; i < queued; i = j)
+    {
+        lane *owner = laneOf((*lined[i])->dev);
+        for (j = i + 1; j < queued && j - i < URING_BATCH && (*lined[j])->dev == owner->dev; ++j);
+        batches[work.nbatches++] = (batch){lined + i, NULL, j - i, kind, owner->class.depth};
+    }
+    share(&work);
+
+    // A lane whose submitter cannot be started is fed from here once others are running
+    bool *started = calloc(nlanes ? nlanes : 1, sizeof(bool));
+    for (size_t i = 0; i < nlanes && started; ++i)
+        started[i] = pthread_create(&lanes[i].submitter, NULL, feedLane, &lanes[i]) == 0;
+    for (size_t i = 0; i < nlanes; ++i)
+        if (!started || !started[i])
+            feedLane(&lanes[i]);
+    for (size_t i = 0; i < nlanes; ++i)
+        if (started && started[i])
+            pthread_join(lanes[i].submitter, NULL);
+    free(started);
+    free(lined);
+    free(batches);
+    free(settlings);
+    settlings = NULL;
+    nsettlings = 0;
+
+    qsort(groups, count, sizeof(group), byStart);
+    return !atomic_load(&outOfMemory);
+}
+
+// Names of partial stages as reported in stats, indexed by stage_kind
+static const char *stageNames[] = {"head", "tail", "sample"};
+
+// No of files left in groups
+static unsigned long long candidates(const group *groups, size_t count)
+{
+    unsigned long long total = 0;
+    for (size_t g = 0; g < count; ++g)
+        total += groups[g].count;
+    return total;
+}
+
+// Bytes a stage reads from files left in groups, a partial stage only the blocks it picks, files settled
+// from cache count too so that estimate stays on the safe side
+static unsigned long long plannedBytes(node **files, const group *groups, size_t count, const stage *partial)
+{
+    unsigned long long total = 0, most = 0;
+    if (partial)
+        most = (unsigned long long)(partial->kind == STAGE_SAMPLE ? partial->samples : 1) * STAGE_BLOCK;
+    for (size_t g = 0; g < count; ++g)
+        for (size_t i = 0; i < groups[g].count; ++i)
+        {
+            unsigned long long size = files[groups[g].start + i]->file_size;
+            total += partial && size > most ? most : size;
+        }
+    return total;
+}
+
+// Files checked by earlier batches, so that progress keeps counting across them
+static unsigned int checkedBase;
+
+// Remaining groups are duplicates, first path in order is kept as parent, a machine readable format writes
+// each group out instead of keeping it on stack until scan is over, unless it was written as it settled
+static bool report(node **files, const group *groups, size_t count, unsigned int *processed)
+{
+    bool success = !streamed || !atomic_load(&outputFailed);
+    for (size_t g = 0; g < count && success; ++g)
+    {
+        node **members = files + groups[g].start;
+        qsort(members, groups[g].count, sizeof(node*), byPath);
+        if (config.format != OUTPUT_TEXT && !streamed)
+            success = output_group(members, groups[g].count, members[0]->hashed ? nodeDigest(members[0]) : NULL);
+        bool keep = config.format == OUTPUT_TEXT || config.dedupe || config.link;
+        for (size_t i = groups[g].count - 1; i > 0; --i)
+        {
+            if (keep)
+                push(members[i], false);
+            ++duplicates;
+            dupsSize += members[i]->file_size;
+        }
+        if (keep)
+            push(members[0], true);
+        *processed += groups[g].count;
+        progress(*processed);
+    }
+    return success;
+}
+
+// Checks count files held by size index
+static bool checkLoaded(size_t count)
+{
+    unsigned int processed_files = checkedBase;
+    if (!count)
+        return true;
+
+    node **files = malloc(count * sizeof(node*));
+    group *groups = malloc(count * sizeof(group));
+    group *refined = malloc(count * sizeof(group));
+    if (!files || !groups || !refined)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(files);
+        free(groups);
+        free(refined);
+        return false;
+    }
+    // Lays out files by exact size, files of unique size are never opened
+    beginStage("size", count, 0);
+    size_t ngroups = partition(files, groups, &processed_files);
+
+    // Paths of a same inode are read once, and never reported as duplicates of each other
+    ngroups = collapse(files, groups, ngroups, refined, &processed_files);
+    memcpy(groups, refined, ngroups * sizeof(group));
+    stats_end(candidates(groups, ngroups));
+
+    // Lines reads up by where files lie, on a spinning disk this turns seeking into a mostly sequential sweep
+    order = settleOrder(files, groups, ngroups);
+
+    io = config.io;
+    if ((io == IO_AUTO || io == IO_URING) && !uring_available())
+    {
+        if (io == IO_URING)
+            fprintf(stderr, "io_uring is unavailable, reading files through stdio\n");
+        io = io == IO_URING ? IO_STDIO : IO_MMAP;
+    }
+
+    if (!openLanes(files, groups, ngroups))
+    {
+        closeLanes();
+        free(files);
+        free(groups);
+        free(refined);
+        return false;
+    }
+    atomic_store(&outOfMemory, false);
+
+    // Splits size groups by xxhash of each partial stage in turn, only files still colliding move on
+    bool success = true;
+    for (currentStage = 0; currentStage < config.nstages && success && ngroups; ++currentStage)
+    {
+        beginStage(stageNames[config.stages[currentStage].kind], candidates(groups, ngroups),
+                   plannedBytes(files, groups, ngroups, &config.stages[currentStage]));
+        success = hashStage(files, groups, ngroups, STREAM_XXHASH);
+        if (success)
+        {
+            ngroups = refine(files, groups, ngroups, refined, byXxhash, hasXxhash, &processed_files);
+            memcpy(groups, refined, ngroups * sizeof(group));
+        }
+        stats_end(candidates(groups, ngroups));
+    }
+
+    // Splits remaining groups by digest of whole file
+    if (success)
+    {
+        beginStage("digest", candidates(groups, ngroups), plannedBytes(files, groups, ngroups, NULL));
+        success = hashStage(files, groups, ngroups, STREAM_DIGEST);
+    }
+    closeLanes();
+    if (success)
+    {
+        ngroups = refine(files, groups, ngroups, refined, byContent, hasContent, &processed_files);
+        memcpy(groups, refined, ngroups * sizeof(group));
+        stats_end(candidates(groups, ngroups));
+    }
+
+    success = success && report(files, groups, ngroups, &processed_files);
+
+    // Remembers digests for next run
+    size_cursor cursor = {0};
+    for (size_group *same; config.cache && success && (same = sizeindex_next(&cursor));)
+        for (unsigned int i = 0; i < same->count && success; ++i)
+            success = cache_update(size_members(same)[i]);
+
+    free(files);
+    free(groups);
+    free(refined);
+    checkedBase = processed_files;
+    return success;
+}
+
+// Memory a candidate takes while its batch is checked, its node along with its slots in index and in arrays of check
+static size_t footprint(const spill_record *record)
+{
+    return sizeof(node) + config.nstages * sizeof(unsigned long long) + config.engine->size + record->length + 1 +
+           2 * sizeof(node*) + 2 * sizeof(group);
+}
+
+// Memory a batch may take, half of budget less what hash cache takes as it stays in memory and grows as batches
+// are checked, while other half reads runs back
+static size_t batchBudget(void)
+{
+    size_t half = config.maxMemory / 2, cache = cache_memory();
+    return half > cache ? half - cache : 0;
+}
+
+// Loads size groups as merge hands them out in ascending size, until batch budget is taken, and checks them as
+// a batch. Nodes of a batch are freed once it is reported, a size group is never split so one larger than budget
+// still goes whole.
+static bool checkSpilled(void)
+{
+    bool success = spill_merge(), failed = false, more = success;
+    spill_group same = {0};
+    while (success && more)
+    {
+        arena *batch = arena_create();
+        if (!batch)
+        {
+            fprintf(stderr, "Not enough memory!\n");
+            success = false;
+            break;
+        }
+
+        size_t used = 0, count = 0;
+        while (success && (!count || used < batchBudget()) && (more = spill_next(&same, &failed)))
+        {
+            checkedBase += same.skipped;
+            for (size_t i = 0; i < same.count && success; ++i)
+            {
+                const spill_record *record = same.records[i];
+                struct stat sb;
+                memset(&sb, 0, sizeof(sb));
+                sb.st_size = record->size;
+                sb.st_dev = record->dev;
+                sb.st_ino = record->ino;
+                sb.st_mtim.tv_sec = record->mtime / 1000000000LL;
+                sb.st_mtim.tv_nsec = record->mtime % 1000000000LL;
+                sb.st_ctim.tv_sec = record->ctime / 1000000000LL;
+                sb.st_ctim.tv_nsec = record->ctime % 1000000000LL;
+                success = load(batch, record->parent, record->name, &sb) != NULL;
+                used += footprint(record);
+            }
+            count += same.count;
+        }
+        if (!more)
+            checkedBase += same.skipped;
+        success = success && !failed && checkLoaded(count);
+
+        // Nodes of batch go away with it, so text is printed now instead of once scan is over
+        if (success && config.format == OUTPUT_TEXT)
+        {
+            stats_begin("output", 0);
+            print();
+            printLinked();
+            stats_end(0);
+        }
+        empty();
+        sizeindex_clear();
+        arena_destroy(batch);
+    }
+    spill_close();
+    progress(checkedBase);
+    return success;
+}
+
+// Whether a merge is waiting on shards for digests
+static bool pending;
+
+static int byRecord(const void *a, const void *b)
+{
+    const node *x = *(node * const *)a, *y = *(node * const *)b;
+    return (x->location > y->location) - (x->location < y->location);
+}
+
+// Asks every shard for digests of its files in groups which still lack one, false when requests cannot be written
+static bool requestDigests(node **files, const group *groups, size_t count, size_t wanted)
+{
+    node **members = malloc(wanted * sizeof(node*));
+    uint64_t *records = malloc(wanted * sizeof(uint64_t));
+    if (!members || !records)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(members);
+        free(records);
+        return false;
+    }
+    size_t n = 0;
+    for (size_t g = 0; g < count; ++g)
+        for (size_t i = 0; i < groups[g].count; ++i)
+            if (!files[groups[g].start + i]->hashed)
+                members[n++] = files[groups[g].start + i];
+    qsort(members, n, sizeof(node*), byRecord);
+
+    bool success = true;
+    for (size_t i = 0, j; i < n && success; i = j)
+    {
+        int shard = members[i]->location >> RECORD_BITS;
+        for (j = i; j < n && (int)(members[j]->location >> RECORD_BITS) == shard; ++j)
+            records[j - i] = members[j]->location & ((1ULL << RECORD_BITS) - 1);
+        success = shard_want(indexes[shard], records, j - i);
+        if (success)
+            fprintf(stderr, "%zu files of %s need digests\n", j - i, indexes[shard]);
+    }
+    if (success)
+        fprintf(stderr, "Run dupsfinder --shard-hash <index> where each of these indexes was made, then merge again\n");
+    free(members);
+    free(records);
+    return success;
+}
+
+// Files of merged indexes cannot be read here, so size groups are settled by digests shards already hold, and
+// until every candidate has one its shard is asked for it instead
+static bool checkMerged(size_t count)
+{
+    unsigned int processed_files = 0;
+    pending = false;
+    if (!count)
+        return true;
+
+    node **files = malloc(count * sizeof(node*));
+    group *groups = malloc(count * sizeof(group));
+    group *refined = malloc(count * sizeof(group));
+    if (!files || !groups || !refined)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(files);
+        free(groups);
+        free(refined);
+        return false;
+    }
+    beginStage("size", count, 0);
+    size_t ngroups = partition(files, groups, &processed_files);
+    ngroups = collapse(files, groups, ngroups, refined, &processed_files);
+    memcpy(groups, refined, ngroups * sizeof(group));
+    stats_end(candidates(groups, ngroups));
+
+    // Files of a unique size across all shards are never hashed
+    size_t wanted = 0;
+    for (size_t g = 0; g < ngroups; ++g)
+        for (size_t i = 0; i < groups[g].count; ++i)
+            wanted += !files[groups[g].start + i]->hashed;
+
+    bool success;
+    if (wanted)
+    {
+        success = requestDigests(files, groups, ngroups, wanted);
+        pending = success;
+    }
+    else
+    {
+        beginStage("digest", candidates(groups, ngroups), 0);
+        ngroups = refine(files, groups, ngroups, refined, byContent, hasContent, &processed_files);
+        memcpy(groups, refined, ngroups * sizeof(group));
+        stats_end(candidates(groups, ngroups));
+        success = report(files, groups, ngroups, &processed_files);
+    }
+
+    free(files);
+    free(groups);
+    free(refined);
+    return success;
+}
+
+// A file left out as descriptors ran out would go missing from its group, so that results are not trusted then
+bool check(void)
+{
+    checkedBase = 0;
+    bool success;
+    if (indexes)
+        success = checkMerged(atomic_load(&no_of_files));
+    else
+        success = config.maxMemory ? checkSpilled() : checkLoaded(atomic_load(&no_of_files));
+    if (success && stats_exhausted())
+    {
+        fprintf(stderr, "Ran out of file descriptors, raise ulimit -n\n");
+        return false;
+    }
+    return success;
+}
+
+bool awaitingDigests(void)
+{
+    return pending;
+}
+
+// Duplicates of one directory, removed through a single descriptor of it so that only basenames are resolved
+typedef struct delete_task
+{
+    node **files;
+    size_t count;
+    unsigned int deleted;
+    unsigned int changed;
+    unsigned long long bytes;
+} delete_task;
+
+// Errors are only counted while deleting, along with first path each one hit, and reported once at end
+#define MAX_ERRNO 256
+static atomic_uint failures[MAX_ERRNO];
+static _Atomic(char *) failedPaths[MAX_ERRNO];
+
+static void deleteFailed(int error, const node *file)
+{
+    int slot = error > 0 && error < MAX_ERRNO ? error : 0;
+    stats_error();
+    if (atomic_fetch_add(&failures[slot], 1) == 0)
+        atomic_store(&failedPaths[slot], nodePath(file));
+}
+
+static int byDirectory(const void *a, const void *b)
+{
+    const node *x = *(node * const *)a, *y = *(node * const *)b;
+    return (x->parent > y->parent) - (x->parent < y->parent);
+}
+
+static void deleteTask(void *arg)
+{
+    delete_task *task = arg;
+    const dir *parent = task->files[0]->parent;
+
+    // Files given as roots have no directory of their own and are reached through their whole path
+    int fd = parent ? dir_open(parent) : AT_FDCWD;
+    stats_open(fd == -1 ? errno : 0);
+    struct stat sb;
+    for (size_t i = 0; i < task->count; ++i)
+    {
+        node *file = task->files[i];
+        if (fd == -1)
+            deleteFailed(errno, file);
+        else if (!nodeUnchanged(fd, nodeName(file), file, &sb))
+            ++task->changed;
+        else if (unlinkat(fd, nodeName(file), 0) == -1)
+            deleteFailed(errno, file);
+        else
+        {
+            ++task->deleted;
+            if (sb.st_nlink == 1)
+                task->bytes += file->file_size;
+        }
+    }
+    if (fd != -1 && fd != AT_FDCWD)
+        close(fd);
+}
+
+bool deleteAll(void)
+{
+    size_t count = 0;
+    for (stack *level = top; level; level = level->next)
+        count += !level->isParent;
+    node **files = malloc(count * sizeof(node*));
+    delete_task *tasks = malloc(count * sizeof(delete_task));
+    if (!files || !tasks)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(files);
+        free(tasks);
+        return false;
+    }
+
+    // Lines duplicates up by directory, each directory becoming one task
+    count = 0;
+    for (stack *level = top; level; level = level->next)
+        if (!level->isParent)
+            files[count++] = level->file;
+    qsort(files, count, sizeof(node*), byDirectory);
+    size_t ntasks = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!ntasks || files[i]->parent != tasks[ntasks - 1].files[0]->parent)
+            tasks[ntasks++] = (delete_task){files + i, 0, 0, 0, 0};
+        ++tasks[ntasks - 1].count;
+    }
+
+    pool *workers = ntasks ? pool_create(config.threads, ntasks) : NULL;
+    if (ntasks && !workers)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(files);
+        free(tasks);
+        return false;
+    }
+    stats_begin("delete", count);
+    for (size_t t = 0; t < ntasks; ++t)
+        pool_submit(workers, deleteTask, &tasks[t]);
+    if (workers)
+    {
+        pool_wait(workers);
+        pool_destroy(workers);
+    }
+
+    unsigned int deleted = 0, changed = 0;
+    unsigned long long bytes = 0;
+    for (size_t t = 0; t < ntasks; ++t)
+    {
+        deleted += tasks[t].deleted;
+        changed += tasks[t].changed;
+        bytes += tasks[t].bytes;
+    }
+    stats_end(deleted);
+    free(files);
+    free(tasks);
+
+    printf("\n\nDeleted %u duplicate files, freeing %llu bytes!\n", deleted, bytes);
+    if (changed)
+        printf("%u files changed since scan were left alone\n", changed);
+    for (int e = 0; e < MAX_ERRNO; ++e)
+    {
+        unsigned int failed = atomic_exchange(&failures[e], 0);
+        if (!failed)
+            continue;
+        char *path = atomic_exchange(&failedPaths[e], NULL);
+        fprintf(stderr, "Unable to remove %u files: %s, like %s\n", failed, e ? strerror(e) : "Unknown error",
+                path ? path : "?");
+        free(path);
+    }
+    printf("\n");
+    return true;
+}
+
+// A group on stack, parent followed by its duplicates, and what an action did to it
+typedef struct group_task
+{
+    stack *parent;
+    size_t count;
+    union
+    {
+        dedupe_result dedupe;
+        link_result link;
+    };
+} group_task;
+
+static void dedupeTask(void *arg)
+{
+    group_task *task = arg;
+    char *keeper = nodePath(task->parent->file);
+    char **paths = calloc(task->count, sizeof(char*));
+    bool built = keeper && paths;
+    stack *level = task->parent->next;
+    for (size_t i = 0; i < task->count && built; ++i, level = level->next)
+        built = (paths[i] = nodePath(level->file)) != NULL;
+    if (!built || dedupe_files(keeper, paths, task->count, task->parent->file->file_size, &task->dedupe) == ENOMEM)
+        atomic_store(&outOfMemory, true);
+    for (size_t i = 0; paths && i < task->count; ++i)
+        free(paths[i]);
+    free(paths);
+    free(keeper);
+}
+
+static void linkTask(void *arg)
+{
+    group_task *task = arg;
+    node **members = malloc((task->count + 1) * sizeof(node*));
+    stack *level = task->parent;
+    for (size_t i = 0; members && i <= task->count; ++i, level = level->next)
+        members[i] = level->file;
+    if (!members || link_files(members, task->count + 1, &task->link) == ENOMEM)
+        atomic_store(&outOfMemory, true);
+    free(members);
+}
+
+// Runs an action on every group on stack in parallel as a stage of its own, NULL when out of memory
+static group_task *actOnGroups(const char *name, task_fn fn, size_t *count)
+{
+    // Stack holds each parent right above its duplicates
+    size_t ngroups = 0;
+    for (stack *level = top; level; level = level->next)
+        ngroups += level->isParent;
+    group_task *tasks = calloc(ngroups, sizeof(group_task));
+    pool *workers = tasks ? pool_create(config.threads, ngroups) : NULL;
+    if (!workers)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(tasks);
+        return NULL;
+    }
+
+    // Groups share nothing, so they are handled in parallel
+    atomic_store(&outOfMemory, false);
+    stats_begin(name, duplicates);
+    size_t g = 0;
+    for (stack *level = top; level; level = level->next)
+    {
+        if (level->isParent)
+            tasks[g++].parent = level;
+        else
+            ++tasks[g - 1].count;
+    }
+    for (g = 0; g < ngroups; ++g)
+        pool_submit(workers, fn, &tasks[g]);
+    pool_wait(workers);
+    pool_destroy(workers);
+    *count = ngroups;
+    return tasks;
+}
+
+bool dedupeAll(void)
+{
+    // Most time goes to kernel comparing ranges of a group
+    size_t ngroups;
+    group_task *tasks = actOnGroups("dedupe", dedupeTask, &ngroups);
+    if (!tasks)
+        return false;
+
+    dedupe_result total = {0};
+    for (size_t g = 0; g < ngroups; ++g)
+    {
+        total.bytes += tasks[g].dedupe.bytes;
+        total.files += tasks[g].dedupe.files;
+        total.differ += tasks[g].dedupe.differ;
+        total.failed += tasks[g].dedupe.failed;
+        if (tasks[g].dedupe.error)
+            total.error = tasks[g].dedupe.error;
+    }
+    stats_end(total.files);
+    free(tasks);
+
+    // Machine readable output keeps stdout to itself
+    FILE *report = config.format == OUTPUT_TEXT ? stdout : stderr;
+    fprintf(report, "\n\nDeduplicated %llu bytes across %u files", total.bytes, total.files);
+    if (total.differ)
+        fprintf(report, ", %u files changed since scan were left alone", total.differ);
+    if (total.failed)
+        fprintf(report, ", %u files could not be deduplicated: %s", total.failed, strerror(total.error));
+    fprintf(report, "\n\n");
+    if (atomic_load(&outOfMemory))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    return true;
+}
+
+bool linkAll(void)
+{
+    // Every directory is opened once per run of duplicates in it, links and renames resolve only a basename
+    size_t ngroups;
+    group_task *tasks = actOnGroups("link", linkTask, &ngroups);
+    if (!tasks)
+        return false;
+
+    link_result total = {0};
+    for (size_t g = 0; g < ngroups; ++g)
+    {
+        total.files += tasks[g].link.files;
+        total.bytes += tasks[g].link.bytes;
+        total.changed += tasks[g].link.changed;
+        total.crossDevice += tasks[g].link.crossDevice;
+        total.failed += tasks[g].link.failed;
+        if (tasks[g].link.error)
+            total.error = tasks[g].link.error;
+    }
+    stats_end(total.files);
+    free(tasks);
+
+    FILE *report = config.format == OUTPUT_TEXT ? stdout : stderr;
+    fprintf(report, "\n\nReplaced %u files with hard links, freeing %llu bytes", total.files, total.bytes);
+    if (total.crossDevice)
+        fprintf(report, ", %u files were kept as first of their group on another device", total.crossDevice);
+    if (total.changed)
+        fprintf(report, ", %u files changed since scan were left alone", total.changed);
+    if (total.failed)
+        fprintf(report, ", %u files could not be replaced: %s", total.failed, strerror(total.error));
+    fprintf(report, "\n\n");
+    if (atomic_load(&outOfMemory))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    return true;
+}
+
+bool unload(void)
+{
+    // Every node lives in an arena, so releasing arenas frees all of them
+    for (size_t i = 0; i < narenas; ++i)
+        arena_destroy(arenas[i]);
+    free(arenas);
+    arenas = NULL;
+    narenas = arenasCapacity = 0;
+    localArena = NULL;
+
+    sizeindex_clear();
+    return true;
+}
+
+unsigned int getDuplicates(void)
+{
+    return duplicates;
+}
+
+void printLinked(void)
+{
+    size_cursor cursor = {0};
+    for (size_group *same; (same = sizeindex_next(&cursor));)
+    {
+        for (unsigned int i = 0; i < same->count; ++i)
+        {
+            node *trav = size_members(same)[i];
+            if (!trav->alias || trav->isAlias)
+                continue;
+            char *path = nodePath(trav);
+            printf("\n\nAlready linked to %s at: \n", path ? path : nodeName(trav));
+            free(path);
+            for (node *alias = trav->alias; alias; alias = alias->alias)
+            {
+                path = nodePath(alias);
+                printf("%s\n", path ? path : nodeName(alias));
+                free(path);
+            }
+        }
+    }
+}
+
+bool writeStats(const char *path)
+{
+    stats_totals totals = {atomic_load(&no_of_files), duplicates, dupsSize, linked};
+    return stats_write(path, &totals);
 }
 
 void stats(void)
 {
     // Total no of duplicates
     printf("\n\n Total no of duplicates: %u", duplicates);
+    if (linked)
+        printf("\n Total no of paths already linked to another: %u", linked);
     
     // Total size calculations
     const unsigned int KB = 1024;
@@ -4,28 +4,166 @@
 #define FINDER_H
 
 #include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
-// Structure of a node in hashtable
+#include "hashes.h"
+#include "paths.h"
+
+// Ways of reading files while hashing them
+typedef enum io_mode
+{
+    IO_AUTO,
+    IO_STDIO,
+    IO_URING,
+    IO_MMAP
+} io_mode;
+
+// Orders in which files are read while hashing
+typedef enum order_mode
+{
+    ORDER_AUTO,
+    ORDER_DISK,
+    ORDER_INODE,
+    ORDER_NONE
+} order_mode;
+
+// Ways duplicates are reported
+typedef enum output_format
+{
+    OUTPUT_TEXT,
+    OUTPUT_NDJSON,
+    OUTPUT_NUL
+} output_format;
+
+// Settings parsed from command line
+typedef struct settings
+{
+    // No of worker threads
+    int threads;
+
+    // Reads used to hash files, by default io_uring when available and mappings for large files
+    io_mode io;
+
+    // Reads sorted by physical offset of files, or by inode where it is unknown, so that a cold run sweeps
+    // a disk instead of seeking, by default only when files lie on a rotational device
+    order_mode order;
+
+    // Hash cache file, NULL to neither read nor write one
+    const char *cache;
+
+    // Whether to start from an empty cache instead of loading it
+    bool rebuildCache;
+
+    // Partial stages run before hashing whole files, head, tail and 8 samples by default
+    stage stages[MAX_STAGES];
+    int nstages;
+
+    // Engine hashing whole files, sha256 by default
+    const engine *engine;
+
+    // Groups of at most this many files are compared byte by byte instead of hashed, 0 to always hash
+    int compareMax;
+
+    // Text is printed once scan is over, other formats are written group by group as they are settled
+    output_format format;
+
+    // Bytes files found may take in memory, 0 for no bound. Under a budget, files wait in sorted runs on scratch
+    // directory and size groups are checked a batch at a time as runs are merged.
+    size_t maxMemory;
+    const char *scratch;
+
+    // Whether duplicates are deduplicated in place, or replaced by hard links, once scan is over, which keeps them
+    // on stack whatever format is
+    bool dedupe;
+    bool link;
+} settings;
+
+extern settings config;
+
+// Structure of a node in size index, followed in same allocation by xxhash of each partial stage,
+// digest of whole file and basename, see nodeXxhash(), nodeDigest() and nodeName()
 typedef struct node
 {
     off_t file_size;
-    char* path;
-    unsigned long long *xxhash;
-    unsigned char *file_hash;
-    struct node* next;
+
+    // Directory holding file, NULL for a file given as root whose name is then its whole path
+    const dir *parent;
+
+    // Identity and change times of file, which tell whether cached digests still hold
+    dev_t dev;
+    ino_t ino;
+    long long mtime;
+    long long ctime;
+
+    // Where file lies on its device, physical offset of its data or else its inode, set only when reads are ordered
+    unsigned long long location;
+    bool physical;
+
+    // No of partial stages whose xxhash is computed
+    unsigned char xxstages;
+
+    // Whether digest of whole file is computed
+    bool hashed;
+
+    // Whether node is an alias hanging off first path of its inode
+    bool isAlias;
+
+    // Class of equal content found by comparing file byte by byte, 0 if never compared or unreadable
+    unsigned int match;
+
+    // Other paths of same inode, through hard links, bind mounts or overlapping roots, never hashed on their own
+    struct node* alias;
 } node;
 
-// Initializes hashtable buckets
+// xxhash of each partial stage
+static inline unsigned long long *nodeXxhash(const node *file)
+{
+    return (unsigned long long *)(file + 1);
+}
+
+// Digest of whole file, as long as digest of selected engine
+static inline unsigned char *nodeDigest(const node *file)
+{
+    return (unsigned char *)(nodeXxhash(file) + config.nstages);
+}
+
+// Name of file within its directory
+static inline char *nodeName(const node *file)
+{
+    return (char *)nodeDigest(file) + config.engine->size;
+}
+
+// Rebuilds whole path of a file, which caller frees, NULL when out of memory
+char *nodePath(const node *file);
+
+// Whether name under directory fd still is a regular file with identity, size and mtime file was scanned with,
+// filling sb with what it is now
+bool nodeUnchanged(int fd, const char *name, const node *file, struct stat *sb);
+
+// Initializes size index
 void initialize(void);
 
-// Function to search directory for files
-bool search(const char*);                    
+// Function to search all directories for files at once
+bool search(char**, int);
+
+// Loads files of shard indexes written by separate scans instead of walking, false if any cannot be read
+bool merge(char **indexes, int count);
 
 // Function to find duplicates
 bool check(void);
 
-// Deletes all duplicate files
-void deleteAll(void);
+// Whether check of a merge stopped to ask shards for digests, through request files next to their indexes
+bool awaitingDigests(void);
+
+// Deletes all duplicate files, false when out of memory
+bool deleteAll(void);
+
+// Shares extents of every duplicate with first file of its group instead of deleting it, false when out of memory
+bool dedupeAll(void);
+
+// Replaces every duplicate with a hard link to first file of its group, false when out of memory
+bool linkAll(void);
 
 // Function to unload files from memory
 bool unload(void);
@@ -33,7 +171,19 @@ bool unload(void);
 // Return total no of duplicates
 unsigned int getDuplicates(void);
 
+// Prints paths which are already links to a same file
+void printLinked(void);
+
 // Gives stats like total duplicates found and size taken by them
 void stats(void);
 
+// Writes time, files, reads and errors of every stage along with totals as JSON, false if it cannot be written
+bool writeStats(const char *path);
+
+// Starts redrawing a status line with rates and ETA from a thread of its own
+void startProgress(void);
+
+// Stops progress line, leaving its last state on screen
+void stopProgress(void);
+
 #endif
\ No newline at end of file
@@ -1,43 +1,201 @@
 //https://www.openssl.org/docs/manmaster/man3/SHA1.html
 //https://stackoverflow.com/questions/2262386/generate-sha256-with-openssl-and-c
 
+// POSIX.1-2008 + XSI, i.e. SuSv4, features, and MAP_ANONYMOUS
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <openssl/sha.h>
 
+#include "hashes.h"
+#include "stats.h"
 #include "xxhash.h"
 
-int sha256_file(char *path, unsigned char *hash)
+static void sha256Init(engine_state *state)
+{
+    SHA256_Init(&state->sha256);
+}
+
+static void sha256Update(engine_state *state, const unsigned char *data, size_t size)
+{
+    SHA256_Update(&state->sha256, data, size);
+}
+
+static void sha256Final(engine_state *state, unsigned char *digest)
+{
+    SHA256_Final(digest, &state->sha256);
+}
+
+static void xxh128Init(engine_state *state)
+{
+    XXH3_128bits_reset(&state->xxh3);
+}
+
+static void xxh128Update(engine_state *state, const unsigned char *data, size_t size)
+{
+    XXH3_128bits_update(&state->xxh3, data, size);
+}
+
+static void xxh128Final(engine_state *state, unsigned char *digest)
+{
+    XXH128_canonicalFromHash((XXH128_canonical_t *)digest, XXH3_128bits_digest(&state->xxh3));
+}
+
+static void blake3Init(engine_state *state)
+{
+    blake3_init(&state->blake3);
+}
+
+static void blake3Update(engine_state *state, const unsigned char *data, size_t size)
+{
+    blake3_update(&state->blake3, data, size);
+}
+
+static void blake3UpdateParallel(engine_state *state, const unsigned char *data, size_t size, int threads)
+{
+    blake3_update_parallel(&state->blake3, data, size, threads);
+}
+
+static void blake3Final(engine_state *state, unsigned char *digest)
+{
+    blake3_final(&state->blake3, digest);
+}
+
+static const engine engines[] =
+{
+    {"sha256", SHA256_DIGEST_LENGTH, sha256Init, sha256Update, NULL, sha256Final},
+    {"xxh128", 16, xxh128Init, xxh128Update, NULL, xxh128Final},
+    {"blake3", BLAKE3_OUT_LEN, blake3Init, blake3Update, blake3UpdateParallel, blake3Final}
+};
+
+#define NO_OF_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+const engine *engine_find(const char *name)
+{
+    for (size_t i = 0; i < NO_OF_ENGINES; ++i)
+        if (strcmp(engines[i].name, name) == 0)
+            return &engines[i];
+    return NULL;
+}
+
+// Digests of "abc", in same order as engines
+static const char *const knownDigests[] =
+{
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "06b05ab6733a618578af5f94892f3950",
+    "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85"
+};
+
+// Bytes hashed to measure throughput of each engine
+#define SELFTEST_SIZE (256 * 1024 * 1024)
+
+static double seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double throughput(const engine *engine, const unsigned char *data, int threads)
+{
+    engine_state state;
+    unsigned char digest[MAX_DIGEST];
+    double start = seconds();
+    engine->init(&state);
+    for (size_t offset = 0; offset < SELFTEST_SIZE; offset += MAP_WINDOW)
+    {
+        if (threads > 1)
+            engine->update_parallel(&state, data + offset, MAP_WINDOW, threads);
+        else
+            engine->update(&state, data + offset, MAP_WINDOW);
+    }
+    engine->final(&state, digest);
+    return SELFTEST_SIZE / (seconds() - start) / (1024 * 1024);
+}
+
+bool engine_selftest(int threads)
+{
+    unsigned char *data = malloc(SELFTEST_SIZE);
+    if (!data)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    for (size_t i = 0; i < SELFTEST_SIZE; ++i)
+        data[i] = i * 2654435761u >> 13;
+
+    bool success = true;
+    for (size_t i = 0; i < NO_OF_ENGINES; ++i)
+    {
+        const engine *engine = &engines[i];
+
+        engine_state state;
+        unsigned char digest[MAX_DIGEST];
+        char hex[2 * MAX_DIGEST + 1];
+        engine->init(&state);
+        engine->update(&state, (const unsigned char *)"abc", 3);
+        engine->final(&state, digest);
+        for (size_t j = 0; j < engine->size; ++j)
+            sprintf(hex + 2 * j, "%02x", digest[j]);
+        bool correct = strcmp(hex, knownDigests[i]) == 0;
+        success = success && correct;
+
+        printf("%-8s %s  %8.1f MB/s", engine->name, correct ? "ok    " : "FAILED", throughput(engine, data, 1));
+        if (engine->update_parallel && threads > 1)
+            printf("  %8.1f MB/s on %d threads", throughput(engine, data, threads), threads);
+        printf("\n");
+    }
+    free(data);
+    return success;
+}
+
+int digest_file(char *path, const engine *engine, unsigned char *hash)
 {
     // Opens file from given path
     FILE *file = fopen(path, "rb");
+    stats_open(!file ? errno : 0);
     if (!file)
     {
         fprintf(stderr, "Unable to open file %s\n", path);
         return ENOENT;
     }
     
-    // Intializes sha256 context structure
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
+    // Intializes state of engine
+    engine_state state;
+    engine->init(&state);
 
-    // To read chunks of data repeatedly and feed them to sha256 update to hash
+    // To read chunks of data repeatedly and feed them to engine to hash
     const int bufSize = 256 * 1024;
     unsigned char *buffer = malloc(bufSize);
     int bytesRead = 0;
     if (!buffer)
     {
         fprintf(stderr, "Out of memory!\n");
+        fclose(file);
         return ENOMEM;
     }
     while ((bytesRead = fread(buffer, 1, bufSize, file)))
     {
-        SHA256_Update(&sha256, buffer, bytesRead);
+        stats_read(bytesRead);
+        engine->update(&state, buffer, bytesRead);
     }
 
     // Places message digest to hash
-    SHA256_Final(hash, &sha256);
+    engine->final(&state, hash);
 
     // Closes file
     fclose(file);
@@ -49,29 +207,311 @@ int sha256_file(char *path, unsigned char *hash)
     return 0;
 }
 
-// Calculates xxhash of a file
-int xxhash_file(char *path, unsigned long long *hash)
-{    
+// Jump target of the thread currently hashing from a mapping, if any
+static __thread sigjmp_buf *mappingGuard;
+
+// Windows being hashed by several threads, whose helpers have no guard to jump to
+static atomic_int sharedWindows;
+
+static struct sigaction previousHandler;
+static long pageSize;
+
+// A mapped file truncated by someone else raises SIGBUS, which fails that file only
+static void onBusError(int sig, siginfo_t *info, void *context)
+{
+    (void)sig;
+    (void)context;
+    if (mappingGuard)
+        siglongjmp(*mappingGuard, 1);
+
+    // Faulting page of a shared window reads as zeros instead, its owner notices file shrank afterwards
+    if (atomic_load(&sharedWindows))
+    {
+        void *page = (void *)((uintptr_t)info->si_addr & ~(uintptr_t)(pageSize - 1));
+        if (mmap(page, pageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+            return;
+    }
+
+    // Not ours, lets previous handler or default action deal with it
+    sigaction(SIGBUS, &previousHandler, NULL);
+    raise(SIGBUS);
+}
+
+static void installGuard(void)
+{
+    pageSize = sysconf(_SC_PAGESIZE);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onBusError;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previousHandler);
+}
+
+// Hashes windows of a mapping, returns false if file shrank underneath
+static bool hashMapped(int fd, off_t size, const engine *engine, int threads, engine_state *state)
+{
+    sigjmp_buf guard;
+    unsigned char *volatile window = NULL;
+    volatile size_t length = 0;
+    if (sigsetjmp(guard, 1))
+    {
+        mappingGuard = NULL;
+        munmap(window, length);
+        return false;
+    }
+
+    for (off_t offset = 0; offset < size; offset += MAP_WINDOW)
+    {
+        length = size - offset < MAP_WINDOW ? size - offset : MAP_WINDOW;
+        window = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+        if (window == MAP_FAILED)
+        {
+            window = NULL;
+            return false;
+        }
+        posix_madvise(window, length, POSIX_MADV_SEQUENTIAL);
+        posix_madvise(window, length, POSIX_MADV_WILLNEED);
+
+        // Starts reading next window while this one is hashed
+        if (offset + MAP_WINDOW < size)
+            posix_fadvise(fd, offset + MAP_WINDOW, MAP_WINDOW, POSIX_FADV_WILLNEED);
+
+        if (engine->update_parallel && threads > 1)
+        {
+            // Helper threads cannot jump back here, so nobody does and file size is checked instead
+            atomic_fetch_add(&sharedWindows, 1);
+            engine->update_parallel(state, window, length, threads);
+            atomic_fetch_sub(&sharedWindows, 1);
+
+            struct stat sb;
+            if (fstat(fd, &sb) == -1 || sb.st_size < offset + (off_t)length)
+            {
+                munmap(window, length);
+                return false;
+            }
+        }
+        else
+        {
+            mappingGuard = &guard;
+            engine->update(state, window, length);
+            mappingGuard = NULL;
+        }
+
+        // Unmaps before next window so that address space stays bounded
+        stats_read(length);
+        munmap(window, length);
+        window = NULL;
+    }
+    return true;
+}
+
+int digest_mapped(char *path, const engine *engine, int threads, unsigned char *hash)
+{
+    static pthread_once_t guardInstalled = PTHREAD_ONCE_INIT;
+    pthread_once(&guardInstalled, installGuard);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    stats_open(fd == -1 ? errno : 0);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Unable to open file %s\n", path);
+        return ENOENT;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+    {
+        stats_error();
+        fprintf(stderr, "Unable to read file %s\n", path);
+        close(fd);
+        return EIO;
+    }
+
+    engine_state state;
+    engine->init(&state);
+
+    if (sb.st_size >= MAP_THRESHOLD)
+    {
+        if (!hashMapped(fd, sb.st_size, engine, threads, &state))
+        {
+            stats_error();
+            fprintf(stderr, "Unable to read file %s\n", path);
+            close(fd);
+            return EIO;
+        }
+    }
+    else
+    {
+        // Small files are cheaper to copy than to map
+        const int bufSize = 256 * 1024;
+        unsigned char *buffer = malloc(bufSize);
+        if (!buffer)
+        {
+            fprintf(stderr, "Out of memory!\n");
+            close(fd);
+            return ENOMEM;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        ssize_t bytesRead;
+        off_t offset = 0;
+        while ((bytesRead = pread(fd, buffer, bufSize, offset)) > 0)
+        {
+            stats_read(bytesRead);
+            engine->update(&state, buffer, bytesRead);
+            offset += bytesRead;
+        }
+        free(buffer);
+        if (bytesRead == -1)
+        {
+            stats_error();
+            fprintf(stderr, "Unable to read file %s\n", path);
+            close(fd);
+            return EIO;
+        }
+    }
+
+    engine->final(&state, hash);
+    close(fd);
+    return 0;
+}
+
+// Calculates xxhash of the blocks a partial stage picks from a file
+int xxhash_file(char *path, const stage *partial, off_t size, unsigned long long *hash)
+{
     // Opens file from given path
-    FILE *file = fopen(path, "rb");
-    if (!file)
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    stats_open(fd == -1 ? errno : 0);
+    if (fd == -1)
     {
         fprintf(stderr, "Unable to open file %s\n", path);
         return -1;
     }
 
-    const int bufSize = 2048;
-    unsigned char *buffer = malloc(bufSize);
-    int bytesRead = fread(buffer, 1, bufSize, file);
-    unsigned long long const seed = 0;
-    *hash = XXH64(buffer, bytesRead, seed);
+    unsigned char buffer[STAGE_BLOCK];
+    hash_stream stream;
+    stream_init(&stream, STREAM_XXHASH, partial, NULL, size);
 
-    // Closes file
-    fclose(file);
+    // Reads every block stage wants, a short read means file ended early
+    off_t offset;
+    size_t length;
+    while (stream_want(&stream, &offset, &length))
+    {
+        ssize_t bytesRead = pread(fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+        if (bytesRead == -1)
+        {
+            stats_error();
+            fprintf(stderr, "Unable to read file %s\n", path);
+            close(fd);
+            return -1;
+        }
+        stats_read(bytesRead);
+        stream_update(&stream, buffer, bytesRead);
+    }
+    stream_final(&stream, hash);
 
-    // Free memory
-    free(buffer);
+    // Closes file
+    close(fd);
 
     // Indicates success
     return 0;
-}
\ No newline at end of file
+}
+
+// Appends a block to read, clamped to file
+static void addSpan(hash_stream *stream, off_t offset, off_t size)
+{
+    if (offset < 0)
+        offset = 0;
+    if (offset >= size || stream->count == MAX_SPANS)
+        return;
+
+    // Samples of small files overlap, reading same bytes twice tells nothing new
+    if (stream->count && stream->spans[stream->count - 1].offset == offset)
+        return;
+
+    stream->spans[stream->count].offset = offset;
+    stream->spans[stream->count].length = size - offset < STAGE_BLOCK ? size - offset : STAGE_BLOCK;
+    ++stream->count;
+}
+
+void stream_init(hash_stream *stream, stream_kind kind, const stage *partial, const engine *engine, off_t size)
+{
+    stream->kind = kind;
+    stream->engine = engine;
+    stream->count = 0;
+    stream->current = 0;
+    stream->done = 0;
+
+    if (kind == STREAM_DIGEST)
+    {
+        // Whole file, until end of file is met
+        stream->spans[0].offset = 0;
+        stream->spans[0].length = SIZE_MAX;
+        stream->count = 1;
+        engine->init(&stream->digest);
+        return;
+    }
+
+    unsigned long long const seed = 0;
+    XXH64_reset(&stream->xxh64, seed);
+    switch (partial->kind)
+    {
+        case STAGE_HEAD:
+            addSpan(stream, 0, size);
+            break;
+
+        case STAGE_TAIL:
+            addSpan(stream, size - STAGE_BLOCK, size);
+            break;
+
+        case STAGE_SAMPLE:
+            // Blocks spread evenly between head and tail, aligned to block size
+            for (int i = 1; i <= partial->samples; ++i)
+            {
+                off_t offset = (off_t)((double)(size - STAGE_BLOCK) * i / (partial->samples + 1));
+                addSpan(stream, offset - offset % STAGE_BLOCK, size);
+            }
+            break;
+    }
+}
+
+bool stream_want(hash_stream *stream, off_t *offset, size_t *length)
+{
+    if (stream->current == stream->count)
+        return false;
+    *offset = stream->spans[stream->current].offset + stream->done;
+    *length = stream->spans[stream->current].length - stream->done;
+    return true;
+}
+
+void stream_update(hash_stream *stream, const unsigned char *data, size_t size)
+{
+    if (stream->kind == STREAM_DIGEST)
+        stream->engine->update(&stream->digest, data, size);
+    else
+        XXH64_update(&stream->xxh64, data, size);
+
+    // Nothing read means end of file, rest of span is skipped
+    stream->done += size;
+    if (!size || stream->done == stream->spans[stream->current].length)
+    {
+        ++stream->current;
+        stream->done = 0;
+    }
+}
+
+void stream_final(hash_stream *stream, void *hash)
+{
+    if (stream->kind == STREAM_DIGEST)
+        stream->engine->final(&stream->digest, hash);
+    else
+        *(unsigned long long *)hash = XXH64_digest(&stream->xxh64);
+}
+
+unsigned long long stages_fingerprint(const stage *stages, int count)
+{
+    unsigned long long const seed = STAGE_BLOCK;
+    return XXH64(stages, count * sizeof(stage), seed);
+}
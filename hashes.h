@@ -1,10 +1,138 @@
 #ifndef HASHES_H
 #define HASHES_H
 
-// Calculates sha256 of a file
-int sha256_file(char *path, unsigned char *hash);
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <openssl/sha.h>
 
-// Calculates xxhash of a buffer
-int xxhash_file(char *path, unsigned long long *hash);
+// Streams embed XXH64 and XXH3 state, whose layout is only exposed for static linking
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+#include "blake3.h"
 
-#endif
\ No newline at end of file
+// Bytes read by each block of a partial stage
+#define STAGE_BLOCK 4096
+
+// Most blocks a partial stage reads from a file
+#define MAX_SPANS 64
+
+// Most partial stages run before hashing whole files
+#define MAX_STAGES 8
+
+// Files of at least this size are hashed straight from a mapping by digest_mapped()
+#define MAP_THRESHOLD (4 * 1024 * 1024)
+
+// Bytes mapped at a time, bounds address space used per thread
+#define MAP_WINDOW (64 * 1024 * 1024)
+
+// Longest digest of any engine
+#define MAX_DIGEST 32
+
+// Running state of whichever engine is hashing, XXH3 aligns it to 64 bytes, which heap copies must keep
+typedef union engine_state
+{
+    SHA256_CTX sha256;
+    XXH3_state_t xxh3;
+    blake3_hasher blake3;
+} engine_state;
+
+// An algorithm hashing whole files, picked at runtime
+typedef struct engine
+{
+    const char *name;
+
+    // Bytes of digest, at most MAX_DIGEST
+    size_t size;
+
+    void (*init)(engine_state *state);
+    void (*update)(engine_state *state, const unsigned char *data, size_t size);
+
+    // Feeds a large buffer using up to given no of threads, NULL if engine cannot split its work
+    void (*update_parallel)(engine_state *state, const unsigned char *data, size_t size, int threads);
+
+    void (*final)(engine_state *state, unsigned char *digest);
+} engine;
+
+// Engine of given name, NULL if there is none
+const engine *engine_find(const char *name);
+
+// Checks every engine against a known digest and prints its throughput, also on given no of threads
+// for engines able to split work, false if any digest is wrong
+bool engine_selftest(int threads);
+
+// Calculates digest of a whole file with given engine
+int digest_file(char *path, const engine *engine, unsigned char *hash);
+
+// Calculates digest of a whole file from a mapping when large, splitting it over threads if engine can,
+// or through pread() otherwise
+int digest_mapped(char *path, const engine *engine, int threads, unsigned char *hash);
+
+// Parts of a file a partial stage looks at
+typedef enum stage_kind
+{
+    STAGE_HEAD,
+    STAGE_TAIL,
+    STAGE_SAMPLE
+} stage_kind;
+
+// A cheap fingerprint taken before hashing whole files, only files still colliding move on to next one
+typedef struct stage
+{
+    stage_kind kind;
+
+    // No of blocks picked across file by a sample stage
+    int samples;
+} stage;
+
+// Calculates xxhash of the blocks a partial stage picks from a file of given size
+int xxhash_file(char *path, const stage *partial, off_t size, unsigned long long *hash);
+
+// Changes whenever stage chain does, so that digests of another chain are never mixed up
+unsigned long long stages_fingerprint(const stage *stages, int count);
+
+// Digests a hash_stream can compute, same as the ones of above functions
+typedef enum stream_kind
+{
+    STREAM_XXHASH,
+    STREAM_DIGEST
+} stream_kind;
+
+// A range of file a stream wants
+typedef struct span
+{
+    off_t offset;
+    size_t length;
+} span;
+
+// Digest state fed range by range by whoever reads file
+typedef struct hash_stream
+{
+    stream_kind kind;
+    const engine *engine;
+    span spans[MAX_SPANS];
+    int count;
+
+    // Span being read and bytes of it already fed
+    int current;
+    size_t done;
+    union
+    {
+        engine_state digest;
+        XXH64_state_t xxh64;
+    };
+} hash_stream;
+
+// Plans reads of a stream, partial stage is used by xxhash streams and engine by whole file ones
+void stream_init(hash_stream *stream, stream_kind kind, const stage *partial, const engine *engine, off_t size);
+
+// Gives next range to read, false once stream has everything it wants
+bool stream_want(hash_stream *stream, off_t *offset, size_t *length);
+
+// Feeds bytes read at offset given by stream_want(), no bytes means end of file
+void stream_update(hash_stream *stream, const unsigned char *data, size_t size);
+
+// Places digest to hash, an unsigned long long for xxhash and size of engine's digest otherwise
+void stream_final(hash_stream *stream, void *hash);
+
+#endif
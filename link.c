@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "link.h"
+#include "stats.h"
+
+// Numbers temporary names, which also carry pid so that runs never collide
+static atomic_uint tempCounter;
+
+// Directory a file is reached through, opened once for every run of files sharing it
+typedef struct holder
+{
+    const dir *entry;
+    int fd;
+
+    // Why directory could not be opened, kept as later calls for it return its -1 without trying again
+    int error;
+} holder;
+
+// Points fd and name at a file for *at() calls, a file given as root is reached through its whole path
+static int reach(holder *held, const node *file, const char **name)
+{
+    *name = nodeName(file);
+    if (!file->parent)
+        return AT_FDCWD;
+    if (held->entry != file->parent)
+    {
+        if (held->fd != -1)
+            close(held->fd);
+        held->entry = file->parent;
+        held->fd = dir_open(file->parent);
+        held->error = held->fd == -1 ? errno : 0;
+        stats_open(held->error);
+    }
+    errno = held->error;
+    return held->fd;
+}
+
+// Builds a temporary name next to a file, in its directory or next to a root given as a whole path
+static bool tempName(const node *file, char *buffer, size_t size)
+{
+    const char *name = nodeName(file), *slash = file->parent ? NULL : strrchr(name, '/');
+    int prefix = slash ? (int)(slash - name + 1) : 0;
+    int length = snprintf(buffer, size, "%.*s.dupsfinder-%d-%u", prefix, name, (int)getpid(),
+                          atomic_fetch_add(&tempCounter, 1));
+    return length > 0 && (size_t)length < size;
+}
+
+int link_files(node **members, size_t count, link_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    holder source = {NULL, -1, 0}, target = {NULL, -1, 0};
+    const char *keeperName, *name;
+    struct stat sb;
+
+    // Whether a member kept for its device still is as scanned, 0 until checked, 1 if so and -1 if not
+    signed char *kept = calloc(count, 1);
+    if (!kept)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return ENOMEM;
+    }
+
+    char temp[PATH_MAX];
+    for (size_t i = 1; i < count; ++i)
+    {
+        // Each file is linked to first member on its own device, a file first on its device is kept as well
+        size_t k = 0;
+        while (members[k]->dev != members[i]->dev)
+            ++k;
+        if (k == i)
+        {
+            ++result->crossDevice;
+            continue;
+        }
+        const node *keeper = members[k], *file = members[i];
+        int keeperFd = reach(&source, keeper, &keeperName);
+
+        // Members of a keeper out of reach are failures rather than changes, so that summary reports why
+        if (keeperFd == -1 && keeper->parent)
+        {
+            result->error = errno;
+            ++result->failed;
+            if (result->error == ENOMEM)
+                break;
+            continue;
+        }
+        if (!kept[k])
+            kept[k] = nodeUnchanged(keeperFd, keeperName, keeper, &sb) ? 1 : -1;
+        if (kept[k] == -1)
+        {
+            ++result->changed;
+            continue;
+        }
+
+        int fd = reach(&target, file, &name);
+        if (file->parent && fd == -1)
+        {
+            result->error = errno;
+            ++result->failed;
+            if (result->error == ENOMEM)
+                break;
+            continue;
+        }
+        if (!nodeUnchanged(fd, name, file, &sb))
+        {
+            ++result->changed;
+            continue;
+        }
+        if (!tempName(file, temp, sizeof(temp)))
+        {
+            result->error = ENAMETOOLONG;
+            ++result->failed;
+            continue;
+        }
+
+        // Rename replaces duplicate atomically, a failed one leaves it and only temporary link is dropped
+        if (linkat(keeperFd, keeperName, fd, temp, 0) == -1)
+        {
+            result->error = errno;
+            ++result->failed;
+            stats_error();
+            continue;
+        }
+        if (renameat(fd, temp, fd, name) == -1)
+        {
+            result->error = errno;
+            ++result->failed;
+            stats_error();
+            unlinkat(fd, temp, 0);
+            continue;
+        }
+        ++result->files;
+        if (sb.st_nlink == 1)
+            result->bytes += file->file_size;
+    }
+
+    if (source.fd != -1)
+        close(source.fd);
+    if (target.fd != -1)
+        close(target.fd);
+    free(kept);
+    return result->error == ENOMEM ? ENOMEM : 0;
+}
@@ -0,0 +1,31 @@
+// Contains declaration of hard link consolidation, which replaces duplicates with links to a kept file
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stddef.h>
+
+#include "finder.h"
+
+// What linking a group achieved
+typedef struct link_result
+{
+    // Files replaced by a link, and bytes freed by them, which only counts files that had no other link
+    unsigned int files;
+    unsigned long long bytes;
+
+    // Files left alone since they or their keeper changed since scan, and files kept as first of group on their device
+    unsigned int changed;
+    unsigned int crossDevice;
+
+    // Files which could not be replaced, along with last error met
+    unsigned int failed;
+    int error;
+} link_result;
+
+// Replaces every member after first with a hard link to first member on same device, which is kept. A link is made
+// under a temporary name in duplicate's directory and renamed over it, so its path names either old file or keeper
+// even if process dies midway. Returns ENOMEM when out of memory, 0 otherwise.
+int link_files(node **members, size_t count, link_result *result);
+
+#endif
@@ -2,15 +2,26 @@
 #define _XOPEN_SOURCE 700
 
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
+#include "cache.h"
+#include "filter.h"
 #include "finder.h"
+#include "output.h"
+#include "shard.h"
 #include "stack.h"
+#include "stats.h"
 
 void help(void);
+char *cacheLocation(void);
+bool parseStages(char *list);
+off_t parseSize(const char *text);
 
 int main(int argc, char* argv[])
 {
@@ -24,15 +35,225 @@ int main(int argc, char* argv[])
     // Flag to know whether to delete files or not
     bool isDelete = false;
 
+    // No of worker threads, defaults to one per online cpu
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Blocks read by sample stages
+    int samples = 8;
+
+    // Hash cache, defaults to ~/.cache/dupsfinder/hashes
+    const char *cachePath = NULL;
+    bool noCache = false;
+    char *defaultCache = NULL;
+
+    // Whether to only test hash engines
+    bool selftest = false;
+
+    // Where stats of every stage are written as JSON, if anywhere
+    const char *statsPath = NULL;
+
+    // Whether to leave out progress line, which is also left out when stdout is not a terminal
+    bool quiet = false;
+
+    // Index a scan is written to instead of being checked, index whose requested digests are computed, and
+    // whether arguments are indexes to merge instead of directories
+    const char *indexPath = NULL;
+    const char *hashPath = NULL;
+    bool merging = false;
+
+    // Options which only have a long form
+    enum { OPT_IO = 256, OPT_CACHE, OPT_NO_CACHE, OPT_REBUILD_CACHE, OPT_STAGES, OPT_SAMPLES, OPT_HASH, OPT_SELFTEST, OPT_COMPARE, OPT_ORDER, OPT_STATS_JSON, OPT_FORMAT, OPT_DEDUPE, OPT_LINK, OPT_MIN_SIZE, OPT_MAX_SIZE, OPT_INCLUDE, OPT_EXCLUDE, OPT_INCLUDE_REGEX, OPT_EXCLUDE_REGEX, OPT_EXCLUDE_DIR, OPT_MAX_MEMORY, OPT_SCRATCH, OPT_SHARD_INDEX, OPT_SHARD_HASH, OPT_MERGE };
+    static const struct option options[] =
+    {
+        {"help", no_argument, NULL, 'h'},
+        {"delete", no_argument, NULL, 'd'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"io", required_argument, NULL, OPT_IO},
+        {"cache", required_argument, NULL, OPT_CACHE},
+        {"no-cache", no_argument, NULL, OPT_NO_CACHE},
+        {"rebuild-cache", no_argument, NULL, OPT_REBUILD_CACHE},
+        {"stages", required_argument, NULL, OPT_STAGES},
+        {"samples", required_argument, NULL, OPT_SAMPLES},
+        {"hash", required_argument, NULL, OPT_HASH},
+        {"selftest", no_argument, NULL, OPT_SELFTEST},
+        {"compare", required_argument, NULL, OPT_COMPARE},
+        {"order", required_argument, NULL, OPT_ORDER},
+        {"stats-json", required_argument, NULL, OPT_STATS_JSON},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"dedupe", no_argument, NULL, OPT_DEDUPE},
+        {"link", no_argument, NULL, OPT_LINK},
+        {"min-size", required_argument, NULL, OPT_MIN_SIZE},
+        {"max-size", required_argument, NULL, OPT_MAX_SIZE},
+        {"include", required_argument, NULL, OPT_INCLUDE},
+        {"exclude", required_argument, NULL, OPT_EXCLUDE},
+        {"include-regex", required_argument, NULL, OPT_INCLUDE_REGEX},
+        {"exclude-regex", required_argument, NULL, OPT_EXCLUDE_REGEX},
+        {"exclude-dir", required_argument, NULL, OPT_EXCLUDE_DIR},
+        {"one-file-system", no_argument, NULL, 'x'},
+        {"max-memory", required_argument, NULL, OPT_MAX_MEMORY},
+        {"scratch", required_argument, NULL, OPT_SCRATCH},
+        {"shard-index", required_argument, NULL, OPT_SHARD_INDEX},
+        {"shard-hash", required_argument, NULL, OPT_SHARD_HASH},
+        {"merge", no_argument, NULL, OPT_MERGE},
+        {NULL, 0, NULL, 0}
+    };
+
     // Parses arguments and form corresponding options
     int opt;
     bool called = false; // To avoid multiple calls to help()
-    while ((opt = getopt(argc, argv, "dh")) != -1)
+    while ((opt = getopt_long(argc, argv, "dhqxj:", options, NULL)) != -1)
     {
         switch (opt)
         {
             case 'd': isDelete = true;
                 break;        
+            case 'j': threads = atol(optarg);
+                break;
+            case OPT_IO:
+                if (strcmp(optarg, "uring") == 0)
+                    config.io = IO_URING;
+                else if (strcmp(optarg, "stdio") == 0)
+                    config.io = IO_STDIO;
+                else if (strcmp(optarg, "mmap") == 0)
+                    config.io = IO_MMAP;
+                else if (strcmp(optarg, "auto") == 0)
+                    config.io = IO_AUTO;
+                else
+                {
+                    fprintf(stderr, "\n Unknown io mode %s!\n", optarg);
+                    help();
+                    return -1;
+                }
+                break;
+            case OPT_CACHE: cachePath = optarg;
+                break;
+            case OPT_NO_CACHE: noCache = true;
+                break;
+            case OPT_REBUILD_CACHE: config.rebuildCache = true;
+                break;
+            case OPT_STAGES:
+                if (!parseStages(optarg))
+                {
+                    help();
+                    return -1;
+                }
+                break;
+            case OPT_SAMPLES: samples = atoi(optarg);
+                if (samples < 1 || samples > MAX_SPANS)
+                {
+                    fprintf(stderr, "\n No of samples must be between 1 and %d!\n", MAX_SPANS);
+                    return -1;
+                }
+                break;
+            case OPT_HASH: config.engine = engine_find(optarg);
+                if (!config.engine)
+                {
+                    fprintf(stderr, "\n Unknown hash %s!\n", optarg);
+                    help();
+                    return -1;
+                }
+                break;
+            case OPT_SELFTEST: selftest = true;
+                break;
+            case OPT_COMPARE: config.compareMax = atoi(optarg);
+                if (config.compareMax < 0)
+                {
+                    fprintf(stderr, "\n No of files compared byte by byte cannot be negative!\n");
+                    return -1;
+                }
+                break;
+            case OPT_ORDER:
+                if (strcmp(optarg, "disk") == 0)
+                    config.order = ORDER_DISK;
+                else if (strcmp(optarg, "inode") == 0)
+                    config.order = ORDER_INODE;
+                else if (strcmp(optarg, "none") == 0)
+                    config.order = ORDER_NONE;
+                else if (strcmp(optarg, "auto") == 0)
+                    config.order = ORDER_AUTO;
+                else
+                {
+                    fprintf(stderr, "\n Unknown read order %s!\n", optarg);
+                    help();
+                    return -1;
+                }
+                break;
+            case OPT_STATS_JSON: statsPath = optarg;
+                break;
+            case 'q': quiet = true;
+                break;
+            case OPT_DEDUPE: config.dedupe = true;
+                break;
+            case OPT_LINK: config.link = true;
+                break;
+            case OPT_MIN_SIZE:
+            case OPT_MAX_SIZE:
+            {
+                off_t size = parseSize(optarg);
+                if (size < 0)
+                {
+                    fprintf(stderr, "\n Invalid size %s!\n", optarg);
+                    help();
+                    return -1;
+                }
+                if (opt == OPT_MIN_SIZE)
+                    filters.minSize = size;
+                else
+                    filters.maxSize = size;
+                break;
+            }
+            case OPT_INCLUDE:
+            case OPT_EXCLUDE:
+            case OPT_INCLUDE_REGEX:
+            case OPT_EXCLUDE_REGEX:
+            case OPT_EXCLUDE_DIR:
+            {
+                rule_kind kind = opt == OPT_EXCLUDE_DIR ? RULE_EXCLUDE_DIR
+                                 : opt == OPT_INCLUDE || opt == OPT_INCLUDE_REGEX ? RULE_INCLUDE : RULE_EXCLUDE;
+                if (!filter_add(kind, optarg, opt == OPT_INCLUDE_REGEX || opt == OPT_EXCLUDE_REGEX))
+                {
+                    filter_free();
+                    return -1;
+                }
+                break;
+            }
+            case 'x': filters.oneFilesystem = true;
+                break;
+            case OPT_MAX_MEMORY:
+            {
+                off_t budget = parseSize(optarg);
+                if (budget < 1024 * 1024)
+                {
+                    fprintf(stderr, "\n Memory budget must be a size of at least 1M!\n");
+                    help();
+                    return -1;
+                }
+                config.maxMemory = budget;
+                break;
+            }
+            case OPT_SCRATCH: config.scratch = optarg;
+                break;
+            case OPT_SHARD_INDEX: indexPath = optarg;
+                break;
+            case OPT_SHARD_HASH: hashPath = optarg;
+                break;
+            case OPT_MERGE: merging = true;
+                break;
+            case OPT_FORMAT:
+                if (strcmp(optarg, "text") == 0)
+                    config.format = OUTPUT_TEXT;
+                else if (strcmp(optarg, "ndjson") == 0)
+                    config.format = OUTPUT_NDJSON;
+                else if (strcmp(optarg, "nul") == 0)
+                    config.format = OUTPUT_NUL;
+                else
+                {
+                    fprintf(stderr, "\n Unknown output format %s!\n", optarg);
+                    help();
+                    return -1;
+                }
+                break;
             case 'h': help();
                 return 0;
             default: help();
@@ -41,6 +262,49 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (threads < 1)
+        threads = 1;
+    if (filters.maxSize && filters.maxSize < filters.minSize)
+    {
+        fprintf(stderr, "\n Largest size cannot be below smallest one!\n");
+        return -1;
+    }
+    if (isDelete + config.dedupe + config.link > 1)
+    {
+        fprintf(stderr, "\n Duplicates can only be either deleted, deduplicated or linked!\n");
+        return -1;
+    }
+    if (config.maxMemory && (isDelete || config.dedupe || config.link))
+    {
+        fprintf(stderr, "\n Under a memory budget duplicates are only reported, not deleted, deduplicated or linked!\n");
+        return -1;
+    }
+    if ((indexPath || merging) && (isDelete || config.dedupe || config.link || config.maxMemory))
+    {
+        fprintf(stderr, "\n Shards are only indexed and merged in memory, and merged files are only reported!\n");
+        return -1;
+    }
+    if (indexPath && merging)
+    {
+        fprintf(stderr, "\n Shard indexes are either written or merged!\n");
+        return -1;
+    }
+    if (config.maxMemory && !config.scratch)
+    {
+        config.scratch = getenv("TMPDIR");
+        if (!config.scratch || !*config.scratch)
+            config.scratch = "/tmp";
+    }
+    if (isDelete && config.format != OUTPUT_TEXT)
+    {
+        fprintf(stderr, "\n Deletion asks for confirmation on stdout, so it only goes along with text output!\n");
+        return -1;
+    }
+    if (selftest)
+        return engine_selftest(threads) ? 0 : -1;
+    if (hashPath)
+        return shard_hash(hashPath, threads) ? 0 : -1;
+
     // Checks whether list of directories supplied or not
     if (!argv[optind])
     {
@@ -52,38 +316,109 @@ int main(int argc, char* argv[])
     // Initializes hash table
     initialize();
 
-    for (int i = optind; i < argc; ++i)
+    config.threads = threads;
+    if (!config.engine)
+        config.engine = engine_find("sha256");
+    for (int i = 0; i < config.nstages; ++i)
+        config.stages[i].samples = config.stages[i].kind == STAGE_SAMPLE ? samples : 0;
+
+    // Loads digests of earlier runs, which a merge has no use for as files of its shards may not even be local
+    if (!noCache && !merging)
+    {
+        if (!cachePath)
+            cachePath = defaultCache = cacheLocation();
+        config.cache = cachePath;
+    }
+    if (config.cache && !config.rebuildCache && !cache_load(config.cache))
     {
-        // Stores directory path
-        char *directory = strdup(argv[i]);
+        free(defaultCache);
+        exit(-1);
+    }
 
-        // Searches directories for file and then loads them to memory    
-        if (search(directory) == false)
-        {
-            // Clears before exiting
-            unload();
+    // Hash cache stays whole in memory, under a budget it is left at most a quarter so that batches still fit
+    if (config.cache && config.maxMemory)
+        cache_limit(config.maxMemory / 4);
+    if (config.cache && config.maxMemory && cache_memory() > config.maxMemory / 4)
+    {
+        fprintf(stderr, "\n Hash cache %s takes more than a quarter of memory budget, raise --max-memory or pass "
+                        "--no-cache!\n", config.cache);
+        cache_free();
+        free(defaultCache);
+        exit(-1);
+    }
+
+    // Progress is redrawn from a thread of its own so that walking and hashing never wait on terminal
+    // Under a memory budget text is printed batch by batch, which a progress line would break up
+    if (!quiet && config.format == OUTPUT_TEXT && !config.maxMemory && !merging && isatty(STDOUT_FILENO))
+        startProgress();
+
+    // Searches all directories for file at once and then loads them to memory, filters are only needed while walking
+    bool found = merging ? merge(&argv[optind], argc - optind) : search(&argv[optind], argc - optind);
+    filter_free();
+    if (found == false)
+    {
+        // Clears before exiting
+        stopProgress();
+        unload();
 
-            exit(-1);
-        }      
-        
-        // Frees memory
-        free(directory);
+        exit(-1);
     }
 
-    // Checks and returns duplicate files
-    if (check() == false)
+    // A shard only writes what it found, with digests cache already holds, and leaves checking to a merge
+    if (indexPath)
+    {
+        stopProgress();
+        bool written = shard_write(indexPath);
+        if (statsPath)
+            writeStats(statsPath);
+        unload();
+        cache_free();
+        free(defaultCache);
+        return written ? 0 : -1;
+    }
+
+    // Checks and returns duplicate files, groups go out as they are settled unless printed as text
+    bool checked = config.format == OUTPUT_TEXT || output_open(config.format, NULL);
+    checked = checked && check();
+    stopProgress();
+    if (config.format != OUTPUT_TEXT)
+        checked = output_close() && checked;
+    if (checked == false)
     {
         // Clears before exiting
         unload();
+        cache_free();
+        free(defaultCache);
 
         exit(-1);
     }
+
+    // Merge cannot go on until shards have hashed files it asked for, so it reports nothing but its stats yet
+    bool pending = awaitingDigests();
+
+    // Saves digests for next run
+    if (config.cache)
+    {
+        cache_save(config.cache);
+        cache_free();
+    }
+    free(defaultCache);
     
-    // Prints all duplicates
-    print();
+    // Prints all duplicates, then paths which are already links to a same file
+    if (config.format == OUTPUT_TEXT && !pending)
+    {
+        stats_begin("output", getDuplicates());
+        print();
+        printLinked();
+        stats_end(getDuplicates());
 
-    // Stats
-    stats();
+        // Stats
+        stats();
+    }
+
+    // Sharing extents or linking keeps every path, so unlike deletion neither needs confirmation
+    bool acted = !config.dedupe || getDuplicates() == 0 || dedupeAll();
+    acted = acted && (!config.link || getDuplicates() == 0 || linkAll());
 
     // File Deletion
     if (isDelete == true && getDuplicates() != 0)
@@ -94,7 +429,7 @@ int main(int argc, char* argv[])
         if (scanf("%c", &choice))
         {
             if (choice == 'Y')
-                deleteAll();
+                acted = deleteAll();
             else
                 printf("\n Cancelled deletion!\n");
         }
@@ -103,6 +438,8 @@ int main(int argc, char* argv[])
             fprintf(stderr, "Unable to read your input!\n");   
         }
     }
+    if (statsPath)
+        writeStats(statsPath);
 
     // Empties stack
     empty();
@@ -110,7 +447,7 @@ int main(int argc, char* argv[])
     // Unloads files from memory
     unload();
 
-    return 0;
+    return pending ? 2 : acted ? 0 : -1;
 }
 
 void help(void)
@@ -118,5 +455,120 @@ void help(void)
     printf("\n Usage: ./dupsfinder <directory list> <options>\n");
     printf("\n Options:\n\n");
     printf("\t -h : to print this help guide\n");
-    printf("\t -d : delete the duplicate files, retaining the first one in each group\n\n");
+    printf("\t -d : delete the duplicate files, retaining the first one in each group\n");
+    printf("\t --dedupe : share extents of every duplicate with first file of its group through FIDEDUPERANGE,\n");
+    printf("\t\t keeping all paths, on filesystems like btrfs and XFS\n");
+    printf("\t --link : replace every duplicate with a hard link to first file of its group on same device,\n");
+    printf("\t\t keeping all paths\n");
+    printf("\t -q, --quiet : leave out progress line, which is only shown when output goes to a terminal\n");
+    printf("\t -j <n> : no of worker threads per non rotational device, defaults to no of cpus\n");
+    printf("\t --io <auto|uring|mmap|stdio> : how files are read while hashing, by default io_uring when available\n");
+    printf("\t\t and mappings for files of 4 MB or more\n");
+    printf("\t --order <auto|disk|inode|none> : read files by physical offset, falling back to inode, by inode only,\n");
+    printf("\t\t or largest groups first, by default disk order on rotational devices only\n");
+    printf("\t --cache <file> : hash cache to use, defaults to ~/.cache/dupsfinder/hashes\n");
+    printf("\t --no-cache : neither read nor write hash cache\n");
+    printf("\t --rebuild-cache : ignore saved digests and write a fresh hash cache\n");
+    printf("\t --stages <list> : comma separated partial stages run before hashing whole files, out of head, tail\n");
+    printf("\t\t and sample, or none, defaults to head,tail,sample\n");
+    printf("\t --samples <n> : no of 4 KB blocks read across file by sample stage, defaults to 8\n");
+    printf("\t --hash <sha256|xxh128|blake3> : digest of whole files, defaults to sha256\n");
+    printf("\t --compare <n> : compare groups of at most n files byte by byte instead of hashing them,\n");
+    printf("\t\t 0 to always hash, defaults to 4\n");
+    printf("\t --format <text|ndjson|nul> : text printed once scan is over, or each group written as soon as it is\n");
+    printf("\t\t settled, as a JSON line with size, hash, digest and paths, along with paths_b64 in base64 when a\n");
+    printf("\t\t path is not UTF-8, or as paths ending in NUL with an empty one after each group\n");
+    printf("\t --min-size <n>, --max-size <n> : only load files of at least, or at most, n bytes, with an optional\n");
+    printf("\t\t K, M, G or T suffix\n");
+    printf("\t --include <glob>, --exclude <glob> : only load files matching an include, if any is given, and no\n");
+    printf("\t\t exclude, a glob with a slash is matched against whole path and otherwise against basename\n");
+    printf("\t --include-regex <re>, --exclude-regex <re> : same with extended regular expressions on whole path\n");
+    printf("\t --exclude-dir <glob> : never read directories matching glob, like .git or node_modules\n");
+    printf("\t -x, --one-file-system : do not descend into filesystems mounted below a root\n");
+    printf("\t --max-memory <n> : keep files found within about n bytes, K, M, G or T suffix allowed, by sorting them\n");
+    printf("\t\t into runs on scratch disk and checking size groups a batch at a time as runs are merged\n");
+    printf("\t --scratch <dir> : where runs go under --max-memory, defaults to $TMPDIR or /tmp\n");
+    printf("\t --shard-index <file> : write files found under directories to a shard index instead of checking them,\n");
+    printf("\t\t with digests hash cache holds, so that separate processes or hosts can scan their own roots\n");
+    printf("\t --merge : arguments are shard indexes, joined by size and reported as one scan, digests of files\n");
+    printf("\t\t colliding in size are asked of shards which lack them and exit status is then 2\n");
+    printf("\t --shard-hash <file> : compute digests a merge asked of shard index file, run where it was made\n");
+    printf("\t --stats-json <file> : write time, files in and out, opens, bytes read and errors of every stage,\n");
+    printf("\t\t peak memory and a histogram of file sizes as JSON to file, - for stdout\n");
+    printf("\t --selftest : check every hash against a known digest and print its throughput\n\n");
+}
+
+// Fills stage chain from a list like head,tail,sample
+bool parseStages(char *list)
+{
+    config.nstages = 0;
+    if (strcmp(list, "none") == 0)
+        return true;
+
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ","))
+    {
+        if (config.nstages == MAX_STAGES)
+        {
+            fprintf(stderr, "\n At most %d stages can be given!\n", MAX_STAGES);
+            return false;
+        }
+
+        stage *next = &config.stages[config.nstages++];
+        if (strcmp(name, "head") == 0)
+            next->kind = STAGE_HEAD;
+        else if (strcmp(name, "tail") == 0)
+            next->kind = STAGE_TAIL;
+        else if (strcmp(name, "sample") == 0)
+            next->kind = STAGE_SAMPLE;
+        else
+        {
+            fprintf(stderr, "\n Unknown stage %s!\n", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads a size in bytes with an optional K, M, G or T suffix in powers of 1024, -1 if invalid
+off_t parseSize(const char *text)
+{
+    char *end;
+    errno = 0;
+    long long size = strtoll(text, &end, 10);
+    if (errno || end == text || size < 0)
+        return -1;
+
+    const char *units = "KMGT";
+    const char *unit = *end ? strchr(units, *end) : NULL;
+    if (*end && (!unit || end[1]))
+        return -1;
+    for (int i = unit ? unit - units + 1 : 0; i > 0; --i)
+    {
+        if (size > LLONG_MAX / 1024)
+            return -1;
+        size *= 1024;
+    }
+    return size;
+}
+
+// Follows XDG base directory spec, returns NULL when no home is known
+char *cacheLocation(void)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "/dupsfinder/hashes";
+    if (!base || !*base)
+    {
+        base = getenv("HOME");
+        suffix = "/.cache/dupsfinder/hashes";
+    }
+    if (!base || !*base)
+        return NULL;
+
+    char *path = malloc(strlen(base) + strlen(suffix) + 1);
+    if (path)
+    {
+        strcpy(path, base);
+        strcat(path, suffix);
+    }
+    return path;
 }
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "output.h"
+
+// Bytes buffered before a write reaches output
+#define OUTPUT_BUFFER (1 << 20)
+
+static FILE *out;
+static output_format format;
+
+// Groups are written by whichever hashing task settles them, one at a time
+static pthread_mutex_t writing = PTHREAD_MUTEX_INITIALIZER;
+
+// Whether output is read while scan goes on, through a pipe or terminal, so that every group is flushed
+static bool live;
+
+// Stays with stdout after output is closed, so it is never freed
+static char buffer[OUTPUT_BUFFER];
+
+bool output_open(output_format chosen, const char *path)
+{
+    format = chosen;
+    out = !path || strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!out)
+    {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // A buffer far larger than stdio's default keeps write calls rare even with millions of paths, a reader on
+    // other end of a pipe still gets each group as soon as it is written
+    setvbuf(out, buffer, _IOFBF, OUTPUT_BUFFER);
+    struct stat sb;
+    live = fstat(fileno(out), &sb) != 0 || !S_ISREG(sb.st_mode);
+    return true;
+}
+
+// Length of a well formed UTF-8 sequence starting at c, 0 for a byte which does not start one
+static size_t utf8Length(const unsigned char *c)
+{
+    if (*c < 0x80)
+        return 1;
+
+    size_t length;
+    unsigned int code, least;
+    if ((*c & 0xE0) == 0xC0)
+    {
+        length = 2;
+        code = *c & 0x1F;
+        least = 0x80;
+    }
+    else if ((*c & 0xF0) == 0xE0)
+    {
+        length = 3;
+        code = *c & 0x0F;
+        least = 0x800;
+    }
+    else if ((*c & 0xF8) == 0xF0)
+    {
+        length = 4;
+        code = *c & 0x07;
+        least = 0x10000;
+    }
+    else
+        return 0;
+
+    // A NUL ends path before a sequence is complete, so continuation bytes are never read past it
+    for (size_t i = 1; i < length; ++i)
+    {
+        if ((c[i] & 0xC0) != 0x80)
+            return 0;
+        code = code << 6 | (c[i] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and code points beyond Unicode are not well formed either
+    if (code < least || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+        return 0;
+    return length;
+}
+
+// Writes a path as a JSON string, quotes, backslashes and control characters are escaped. Linux allows any byte
+// but NUL and slash in a name, so a byte which is not part of well formed UTF-8 goes as U+FFFD to keep line valid,
+// and false is returned as string then no longer holds path as it is.
+static bool jsonString(const char *text)
+{
+    bool exact = true;
+    putc('"', out);
+    for (const unsigned char *c = (const unsigned char *)text; *c;)
+    {
+        size_t length = utf8Length(c);
+        if (!length)
+        {
+            fputs("\\ufffd", out);
+            exact = false;
+            ++c;
+            continue;
+        }
+        if (*c == '"' || *c == '\\')
+        {
+            putc('\\', out);
+            putc(*c, out);
+        }
+        else if (*c < 0x20 || *c == 0x7f)
+            fprintf(out, "\\u%04x", *c);
+        else
+            fwrite(c, 1, length, out);
+        c += length;
+    }
+    putc('"', out);
+    return exact;
+}
+
+// Writes bytes of a path as a base64 JSON string
+static void base64String(const char *text)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char *c = (const unsigned char *)text;
+    size_t length = strlen(text);
+    putc('"', out);
+    for (size_t i = 0; i < length; i += 3)
+    {
+        unsigned long bits = (unsigned long)c[i] << 16 | (i + 1 < length ? c[i + 1] << 8 : 0) |
+                             (i + 2 < length ? c[i + 2] : 0);
+        putc(digits[bits >> 18 & 63], out);
+        putc(digits[bits >> 12 & 63], out);
+        putc(i + 1 < length ? digits[bits >> 6 & 63] : '=', out);
+        putc(i + 2 < length ? digits[bits & 63] : '=', out);
+    }
+    putc('"', out);
+}
+
+// Writes one group, caller holds output
+static bool writeGroup(node **members, size_t count, const unsigned char *digest)
+{
+    if (format == OUTPUT_NDJSON)
+    {
+        fprintf(out, "{\"size\": %lld, \"hash\": ", (long long)members[0]->file_size);
+        if (digest)
+        {
+            fprintf(out, "\"%s\", \"digest\": \"", config.engine->name);
+            for (size_t i = 0; i < config.engine->size; ++i)
+                fprintf(out, "%02x", digest[i]);
+            putc('"', out);
+        }
+        else
+            fputs("\"compare\", \"digest\": null", out);
+        fputs(", \"paths\": [", out);
+    }
+
+    bool exact = true;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char *path = nodePath(members[i]);
+        if (!path)
+        {
+            fprintf(stderr, "Not enough memory!\n");
+            return false;
+        }
+        if (format == OUTPUT_NDJSON)
+        {
+            if (i)
+                fputs(", ", out);
+            exact = jsonString(path) && exact;
+        }
+        else
+        {
+            fputs(path, out);
+            putc('\0', out);
+        }
+        free(path);
+    }
+
+    // Paths which are not UTF-8 are also given as their bytes, in base64 and in same order
+    if (format == OUTPUT_NDJSON && !exact)
+    {
+        fputs("], \"paths_b64\": [", out);
+        for (size_t i = 0; i < count; ++i)
+        {
+            char *path = nodePath(members[i]);
+            if (!path)
+            {
+                fprintf(stderr, "Not enough memory!\n");
+                return false;
+            }
+            if (i)
+                fputs(", ", out);
+            base64String(path);
+            free(path);
+        }
+    }
+
+    // A NUL delimited group ends with an empty path
+    if (format == OUTPUT_NDJSON)
+        fputs("]}\n", out);
+    else
+        putc('\0', out);
+    return !ferror(out);
+}
+
+bool output_group(node **members, size_t count, const unsigned char *digest)
+{
+    pthread_mutex_lock(&writing);
+    bool success = writeGroup(members, count, digest) && (!live || fflush(out) == 0);
+    pthread_mutex_unlock(&writing);
+    return success;
+}
+
+bool output_close(void)
+{
+    if (!out)
+        return true;
+    bool success = !ferror(out);
+    success = (out == stdout ? fflush(out) : fclose(out)) == 0 && success;
+    if (!success)
+        fprintf(stderr, "Unable to write duplicates: %s\n", strerror(errno));
+    out = NULL;
+    return success;
+}
@@ -0,0 +1,21 @@
+// Contains declaration of machine readable output, which writes every group of duplicates as soon as it is settled
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "finder.h"
+
+// Opens output on a file, or stdout for NULL or -, behind a large buffer
+bool output_open(output_format format, const char *path);
+
+// Writes a group of identical files, first one being kept, digest is NULL when group was compared byte by byte.
+// Safe to call from several threads, each group is written whole and flushed when output is a pipe or terminal.
+bool output_group(node **members, size_t count, const unsigned char *digest);
+
+// Flushes and closes output, false if any write failed
+bool output_close(void);
+
+#endif
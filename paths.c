@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "paths.h"
+
+dir *dir_add(arena *pool, const dir *parent, const char *name)
+{
+    size_t length = strlen(name);
+    dir *entry = arena_alloc(pool, sizeof(dir) + length + 1);
+    if (!entry)
+        return NULL;
+    entry->parent = parent;
+    entry->length = length;
+    memcpy(entry->name, name, length + 1);
+    return entry;
+}
+
+// Only a root given with a trailing slash already ends with one
+static size_t separator(const dir *entry)
+{
+    return entry->length && entry->name[entry->length - 1] != '/';
+}
+
+char *path_build(const dir *parent, const char *name)
+{
+    size_t nameLength = strlen(name), length = nameLength;
+    for (const dir *entry = parent; entry; entry = entry->parent)
+        length += entry->length + separator(entry);
+
+    char *path = malloc(length + 1);
+    if (!path)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return NULL;
+    }
+
+    // Filled from the end, walking up to root
+    length -= nameLength;
+    memcpy(path + length, name, nameLength + 1);
+    for (const dir *entry = parent; entry; entry = entry->parent)
+    {
+        if (separator(entry))
+            path[--length] = '/';
+        length -= entry->length;
+        memcpy(path + length, entry->name, entry->length);
+    }
+    return path;
+}
+
+int dir_open(const dir *entry)
+{
+    char *path = path_build(entry->parent, entry->name);
+    if (!path)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(path);
+    return fd;
+}
+
+// Path of a file below some directory, read a byte at a time instead of being built. Only directory holding file
+// is kept, and directories above it are found by walking up when cursor reaches them.
+typedef struct path_cursor
+{
+    const dir *bottom;
+    const char *file;
+
+    // Directories between top one and file, and one being read, which is file at last level
+    size_t levels;
+    size_t level;
+    const dir *entry;
+    size_t offset;
+
+    // Whether separator after directory being read is still due
+    bool slash;
+} path_cursor;
+
+static void enter(path_cursor *at, size_t level)
+{
+    at->level = level;
+    at->offset = 0;
+    at->entry = NULL;
+    if (level < at->levels)
+    {
+        at->entry = at->bottom;
+        for (size_t up = at->levels - 1 - level; up; --up)
+            at->entry = at->entry->parent;
+    }
+    at->slash = at->entry && separator(at->entry);
+}
+
+// Next byte of path, 0 once it is over
+static unsigned char nextByte(path_cursor *at)
+{
+    while (at->entry)
+    {
+        if (at->offset < at->entry->length)
+            return at->entry->name[at->offset++];
+        if (at->slash)
+        {
+            at->slash = false;
+            return '/';
+        }
+        enter(at, at->level + 1);
+    }
+    return at->file[at->offset] ? at->file[at->offset++] : 0;
+}
+
+static size_t depth(const dir *entry)
+{
+    size_t levels = 0;
+    for (; entry; entry = entry->parent)
+        ++levels;
+    return levels;
+}
+
+int path_compare(const dir *x, const char *xname, const dir *y, const char *yname)
+{
+    // Entries of a same directory share whole prefix
+    if (x == y)
+        return strcmp(xname, yname);
+
+    // Both paths share that of their lowest common directory, so only what lies below it is read
+    size_t xdepth = depth(x), ydepth = depth(y), common = xdepth < ydepth ? xdepth : ydepth;
+    const dir *a = x, *b = y;
+    for (size_t i = xdepth; i > common; --i)
+        a = a->parent;
+    for (size_t i = ydepth; i > common; --i)
+        b = b->parent;
+    for (; a != b; --common)
+    {
+        a = a->parent;
+        b = b->parent;
+    }
+
+    path_cursor xat = {.bottom = x, .file = xname, .levels = xdepth - common};
+    path_cursor yat = {.bottom = y, .file = yname, .levels = ydepth - common};
+    enter(&xat, 0);
+    enter(&yat, 0);
+    while (true)
+    {
+        unsigned char xc = nextByte(&xat), yc = nextByte(&yat);
+        if (xc != yc)
+            return xc < yc ? -1 : 1;
+        if (!xc)
+            return 0;
+    }
+}
@@ -0,0 +1,30 @@
+// Contains declaration of directory table which lets files keep a basename instead of a whole path
+
+#ifndef PATHS_H
+#define PATHS_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+// A directory found while walking, a root has no parent and its path as given for name
+typedef struct dir
+{
+    const struct dir *parent;
+    size_t length;
+    char name[];
+} dir;
+
+// Adds a directory below parent to table, NULL when out of memory
+dir *dir_add(arena *pool, const dir *parent, const char *name);
+
+// Rebuilds whole path of an entry of a directory, or name itself without one, NULL when out of memory
+char *path_build(const dir *parent, const char *name);
+
+// Opens a directory of table for *at() calls, -1 with errno set when it cannot be
+int dir_open(const dir *entry);
+
+// Orders paths of two entries like strcmp() would order their whole paths, without building either of them
+int path_compare(const dir *x, const char *xname, const dir *y, const char *yname);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+typedef struct task
+{
+    task_fn fn;
+    void *arg;
+} task;
+
+struct pool
+{
+    pthread_mutex_t lock;
+
+    // Signalled when a task is queued or pool is stopping
+    pthread_cond_t not_empty;
+
+    // Signalled when a task leaves the queue, for blocked submitters
+    pthread_cond_t not_full;
+
+    // Signalled when last running task finishes
+    pthread_cond_t idle;
+
+    // Ring buffer of queued tasks
+    task *tasks;
+    size_t capacity, head, count;
+
+    // Tasks queued or running
+    size_t pending;
+
+    bool stopping;
+    int threads;
+    pthread_t *tids;
+};
+
+static void *worker(void *arg)
+{
+    pool *workers = arg;
+    pthread_mutex_lock(&workers->lock);
+    while (true)
+    {
+        while (!workers->count && !workers->stopping)
+            pthread_cond_wait(&workers->not_empty, &workers->lock);
+        if (!workers->count)
+            break;
+
+        task next = workers->tasks[workers->head];
+        workers->head = (workers->head + 1) % workers->capacity;
+        --workers->count;
+        pthread_cond_signal(&workers->not_full);
+        pthread_mutex_unlock(&workers->lock);
+
+        next.fn(next.arg);
+
+        pthread_mutex_lock(&workers->lock);
+        if (--workers->pending == 0)
+            pthread_cond_broadcast(&workers->idle);
+    }
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+pool *pool_create(int threads, size_t capacity)
+{
+    pool *workers = calloc(1, sizeof(pool));
+    if (!workers)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return NULL;
+    }
+
+    if (threads < 1)
+        threads = 1;
+    workers->capacity = capacity ? capacity : 1;
+    workers->tasks = malloc(workers->capacity * sizeof(task));
+    workers->tids = malloc(threads * sizeof(pthread_t));
+    if (!workers->tasks || !workers->tids)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(workers->tasks);
+        free(workers->tids);
+        free(workers);
+        return NULL;
+    }
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->not_empty, NULL);
+    pthread_cond_init(&workers->not_full, NULL);
+    pthread_cond_init(&workers->idle, NULL);
+
+    for (; workers->threads < threads; ++workers->threads)
+    {
+        if (pthread_create(&workers->tids[workers->threads], NULL, worker, workers))
+            break;
+    }
+    if (!workers->threads)
+    {
+        fprintf(stderr, "Unable to start worker threads\n");
+        pool_destroy(workers);
+        return NULL;
+    }
+    return workers;
+}
+
+void pool_submit(pool *workers, task_fn fn, void *arg)
+{
+    pthread_mutex_lock(&workers->lock);
+
+    // Backpressure, waits for workers to drain queue
+    while (workers->count == workers->capacity)
+        pthread_cond_wait(&workers->not_full, &workers->lock);
+
+    workers->tasks[(workers->head + workers->count) % workers->capacity] = (task){fn, arg};
+    ++workers->count;
+    ++workers->pending;
+    pthread_cond_signal(&workers->not_empty);
+    pthread_mutex_unlock(&workers->lock);
+}
+
+void pool_wait(pool *workers)
+{
+    pthread_mutex_lock(&workers->lock);
+    while (workers->pending)
+        pthread_cond_wait(&workers->idle, &workers->lock);
+    pthread_mutex_unlock(&workers->lock);
+}
+
+void pool_destroy(pool *workers)
+{
+    if (!workers)
+        return;
+
+    pthread_mutex_lock(&workers->lock);
+    workers->stopping = true;
+    pthread_cond_broadcast(&workers->not_empty);
+    pthread_mutex_unlock(&workers->lock);
+
+    for (int i = 0; i < workers->threads; ++i)
+        pthread_join(workers->tids[i], NULL);
+
+    pthread_mutex_destroy(&workers->lock);
+    pthread_cond_destroy(&workers->not_empty);
+    pthread_cond_destroy(&workers->not_full);
+    pthread_cond_destroy(&workers->idle);
+    free(workers->tasks);
+    free(workers->tids);
+    free(workers);
+}
@@ -0,0 +1,26 @@
+// Contains declaration of thread pool used to hash files in parallel
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct pool pool;
+
+// Task run by a worker thread
+typedef void (*task_fn)(void *arg);
+
+// Starts given no of workers sharing a queue which holds at most capacity tasks
+pool *pool_create(int threads, size_t capacity);
+
+// Queues a task, blocks while queue is full
+void pool_submit(pool *workers, task_fn fn, void *arg);
+
+// Blocks until every submitted task has finished
+void pool_wait(pool *workers);
+
+// Stops workers and frees pool
+void pool_destroy(pool *workers);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "progress.h"
+
+// Milliseconds between redraws
+#define PROGRESS_INTERVAL 500
+
+// Weight of latest interval in smoothed rates
+#define SMOOTHING 0.3
+
+static progress_fn takeSnapshot;
+static pthread_t reporterThread;
+static bool running;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+// What last redraw saw, to derive rates from
+static progress_state last;
+static double lastTime;
+static double fileRate, byteRate;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Formats a size with a unit into buffer
+static const char *human(unsigned long long bytes, char *buffer, size_t size)
+{
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = bytes;
+    int unit = 0;
+    for (; value >= 1024 && unit < 4; ++unit)
+        value /= 1024;
+    snprintf(buffer, size, unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+    return buffer;
+}
+
+static void draw(void)
+{
+    progress_state state;
+    memset(&state, 0, sizeof(state));
+    takeSnapshot(&state);
+
+    double time = now(), elapsed = time - lastTime;
+    bool sameStage = state.stage == last.stage;
+    if (elapsed > 0)
+    {
+        // Walk is measured in files found and later stages in files checked, and a new stage restarts its
+        // byte count, so rates start over whenever they stop measuring same thing
+        bool walking = state.stage && !strcmp(state.stage, "walk");
+        bool wasWalking = last.stage && !strcmp(last.stage, "walk");
+        double files = walking == wasWalking ? ((double)(walking ? state.files : state.checked) -
+                                                (double)(walking ? last.files : last.checked)) / elapsed : 0;
+        double bytes = sameStage ? ((double)state.bytesDone - (double)last.bytesDone) / elapsed : 0;
+        fileRate = walking == wasWalking ? fileRate * (1 - SMOOTHING) + (files > 0 ? files : 0) * SMOOTHING : 0;
+        byteRate = sameStage ? byteRate * (1 - SMOOTHING) + (bytes > 0 ? bytes : 0) * SMOOTHING : 0;
+    }
+    last = state;
+    lastTime = time;
+
+    if (!state.stage)
+        return;
+    if (!strcmp(state.stage, "walk"))
+    {
+        printf("\r walk: %llu files found, %.0f files/s\033[K", state.files, fileRate);
+    }
+    else
+    {
+        char left[32], eta[32] = "--";
+        unsigned long long remaining = state.bytesTotal > state.bytesDone ? state.bytesTotal - state.bytesDone : 0;
+        if (byteRate > 0)
+        {
+            long seconds = remaining / byteRate;
+            snprintf(eta, sizeof(eta), "%ld:%02ld:%02ld", seconds / 3600, seconds / 60 % 60, seconds % 60);
+        }
+        printf("\r %s: %llu/%llu files checked, %llu duplicates | %.0f files/s, %.1f MB/s | %s left, ETA %s\033[K",
+               state.stage, state.checked, state.files, state.duplicates, fileRate, byteRate / (1024 * 1024),
+               human(remaining, left, sizeof(left)), eta);
+    }
+    fflush(stdout);
+}
+
+static void *reporter(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PROGRESS_INTERVAL * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&wake, &lock, &deadline);
+        draw();
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void progress_start(progress_fn snapshot)
+{
+    takeSnapshot = snapshot;
+    memset(&last, 0, sizeof(last));
+    lastTime = now();
+    fileRate = byteRate = 0;
+    running = true;
+    if (pthread_create(&reporterThread, NULL, reporter, NULL))
+        running = false;
+}
+
+void progress_stop(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    running = false;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(reporterThread, NULL);
+}
@@ -0,0 +1,30 @@
+// Contains declaration of progress reporter redrawing a status line from its own thread
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+// Where a scan stands, filled by whoever started reporter
+typedef struct progress_state
+{
+    // Stage running, NULL before first one
+    const char *stage;
+
+    // Files found, files whose fate is settled, and duplicates among them
+    unsigned long long files;
+    unsigned long long checked;
+    unsigned long long duplicates;
+
+    // Bytes current stage read so far and expects to read in all
+    unsigned long long bytesDone;
+    unsigned long long bytesTotal;
+} progress_state;
+
+typedef void (*progress_fn)(progress_state *state);
+
+// Starts a thread which takes a snapshot a few times a second and redraws status line on stdout with rates and ETA
+void progress_start(progress_fn snapshot);
+
+// Draws status line one last time and stops reporter, does nothing if it never started
+void progress_stop(void);
+
+#endif
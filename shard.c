@@ -0,0 +1,558 @@
+// POSIX.1-2008 + XSI, i.e. SuSv4, features
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "finder.h"
+#include "pool.h"
+#include "shard.h"
+#include "sizeindex.h"
+
+// Bumped whenever layout of records changes
+#define SHARD_MAGIC "DUPSSHRD"
+#define SHARD_VERSION 1
+#define WANT_MAGIC "DUPSWANT"
+
+// Flags of a file, whether its digest is known and whether it changed before shard could hash it
+#define HAS_DIGEST 1
+#define CHANGED 2
+
+// Buffer given to stdio while reading or writing an index
+#define SHARD_BUFFER (1 << 20)
+
+typedef struct shard_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t digestSize;
+    uint64_t dirs;
+    uint64_t files;
+
+    // Engine of digests, and host index was made on
+    char engine[16];
+    char label[64];
+} shard_header;
+
+// Directory as stored, followed by its name without a NUL, parent is no of an earlier directory counting from 1
+// or 0 for a root
+typedef struct dir_record
+{
+    uint64_t parent;
+    uint32_t length;
+    uint32_t unused;
+} dir_record;
+
+// File as stored, followed by digest of engine and name without a NUL, dir is no of its directory counting from 1
+// or 0 for a root given as a file
+typedef struct file_record
+{
+    int64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t ctime;
+    uint64_t dir;
+    uint32_t flags;
+    uint32_t length;
+} file_record;
+
+// Nos given to directories while writing, an open addressing table keyed on directory
+typedef struct dir_slot
+{
+    const dir *key;
+    uint64_t id;
+} dir_slot;
+
+static dir_slot *slots;
+static size_t capacity, written;
+
+static size_t slotOf(const dir *key)
+{
+    uint64_t h = (uintptr_t)key * 0x9E3779B97F4A7C15ULL;
+    size_t slot = (h ^ h >> 29) & (capacity - 1);
+    while (slots[slot].key && slots[slot].key != key)
+        slot = (slot + 1) & (capacity - 1);
+    return slot;
+}
+
+// Keeps table at most half full
+static bool reserve(void)
+{
+    if ((written + 1) * 2 <= capacity)
+        return true;
+    size_t size = capacity ? capacity * 2 : 1024;
+    dir_slot *old = slots;
+    size_t oldCapacity = capacity;
+    if (!(slots = calloc(size, sizeof(dir_slot))))
+    {
+        slots = old;
+        return false;
+    }
+    capacity = size;
+    for (size_t i = 0; i < oldCapacity; ++i)
+        if (old[i].key)
+            slots[slotOf(old[i].key)] = old[i];
+    free(old);
+    return true;
+}
+
+// No of a directory, writing it after any parent not written yet, 0 for none and on failure
+static uint64_t dirId(const dir *entry, FILE *out, bool *failed)
+{
+    if (!entry || *failed)
+        return 0;
+    size_t slot = slotOf(entry);
+    if (slots[slot].key)
+        return slots[slot].id;
+
+    dir_record stored = {dirId(entry->parent, out, failed), (uint32_t)entry->length, 0};
+    if (*failed || !reserve())
+    {
+        *failed = true;
+        return 0;
+    }
+    *failed = fwrite(&stored, sizeof(stored), 1, out) != 1 || fwrite(entry->name, entry->length, 1, out) != 1;
+
+    // Table may have grown since slot was found
+    slot = slotOf(entry);
+    slots[slot].key = entry;
+    slots[slot].id = ++written;
+    return written;
+}
+
+bool shard_write(const char *path)
+{
+    size_t length = strlen(path) + 32;
+    char *temp = malloc(length);
+    if (!temp)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    snprintf(temp, length, "%s.%ld.tmp", path, (long)getpid());
+    FILE *out = fopen(temp, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Unable to write shard index %s: %s\n", temp, strerror(errno));
+        free(temp);
+        return false;
+    }
+    setvbuf(out, NULL, _IOFBF, SHARD_BUFFER);
+
+    shard_header head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, SHARD_MAGIC, sizeof(head.magic));
+    head.version = SHARD_VERSION;
+    head.digestSize = config.engine->size;
+    strncpy(head.engine, config.engine->name, sizeof(head.engine) - 1);
+    gethostname(head.label, sizeof(head.label) - 1);
+    bool failed = !reserve() || fwrite(&head, sizeof(head), 1, out) != 1;
+
+    // Directories go first, so that a reader has every parent before its files
+    size_cursor cursor = {0};
+    for (size_group *same; !failed && (same = sizeindex_next(&cursor));)
+        for (unsigned int i = 0; i < same->count && !failed; ++i)
+            dirId(size_members(same)[i]->parent, out, &failed);
+    head.dirs = written;
+
+    unsigned char digest[MAX_DIGEST];
+    cursor = (size_cursor){0};
+    for (size_group *same; !failed && (same = sizeindex_next(&cursor));)
+    {
+        for (unsigned int i = 0; i < same->count && !failed; ++i)
+        {
+            const node *file = size_members(same)[i];
+            const char *name = nodeName(file);
+            file_record stored = {file->file_size, file->dev, file->ino, file->mtime, file->ctime,
+                                  dirId(file->parent, out, &failed), 0, (uint32_t)strlen(name)};
+            memset(digest, 0, sizeof(digest));
+            if (cache_lookup(file, STREAM_DIGEST, 0, digest))
+                stored.flags |= HAS_DIGEST;
+            failed = failed || fwrite(&stored, sizeof(stored), 1, out) != 1 ||
+                     fwrite(digest, head.digestSize, 1, out) != 1 || fwrite(name, stored.length, 1, out) != 1;
+            ++head.files;
+        }
+    }
+
+    // Header is rewritten once counts are known
+    failed = failed || fseek(out, 0, SEEK_SET) != 0 || fwrite(&head, sizeof(head), 1, out) != 1;
+    failed = failed || fflush(out) != 0 || fsync(fileno(out)) != 0;
+    failed = fclose(out) != 0 || failed;
+    failed = failed || rename(temp, path) != 0;
+    if (failed)
+    {
+        fprintf(stderr, "Unable to write shard index %s\n", path);
+        unlink(temp);
+    }
+    free(temp);
+    free(slots);
+    slots = NULL;
+    capacity = written = 0;
+    return !failed;
+}
+
+// Checks header of an index, false if it is not one this build can merge
+static bool validHeader(const shard_header *head, const char *path)
+{
+    if (memcmp(head->magic, SHARD_MAGIC, sizeof(head->magic)) != 0 || head->version != SHARD_VERSION ||
+        head->digestSize > MAX_DIGEST || !memchr(head->engine, '\0', sizeof(head->engine)) ||
+        !memchr(head->label, '\0', sizeof(head->label)))
+    {
+        fprintf(stderr, "%s is not a shard index\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Checks counts of header against size of index, so that a damaged one never sizes an allocation
+static bool validCounts(const shard_header *head, off_t size, const char *path)
+{
+    uint64_t room = size > (off_t)sizeof(*head) ? (uint64_t)size - sizeof(*head) : 0;
+    uint64_t file = sizeof(file_record) + head->digestSize;
+    if (head->dirs > room / sizeof(dir_record) || head->files > room / file ||
+        head->dirs * sizeof(dir_record) + head->files * file > room)
+    {
+        fprintf(stderr, "Shard index %s is damaged\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool shard_label(const char *path, char *label, size_t size)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Unable to read shard index %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    shard_header head;
+    bool success = fread(&head, sizeof(head), 1, in) == 1 && validHeader(&head, path);
+    if (success)
+        snprintf(label, size, "%s", head.label);
+    fclose(in);
+    return success;
+}
+
+bool shard_read(const char *path, shard_dir_fn enter, shard_file_fn fn)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Unable to read shard index %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    setvbuf(in, NULL, _IOFBF, SHARD_BUFFER);
+
+    shard_header head;
+    struct stat sb;
+    bool success = fread(&head, sizeof(head), 1, in) == 1 && validHeader(&head, path) &&
+                   fstat(fileno(in), &sb) == 0 && validCounts(&head, sb.st_size, path);
+    if (success && (strcmp(head.engine, config.engine->name) != 0 || head.digestSize != config.engine->size))
+    {
+        fprintf(stderr, "%s holds %s digests, merge it with --hash %s\n", path, head.engine, head.engine);
+        success = false;
+    }
+
+    void **dirs = success ? malloc((head.dirs ? head.dirs : 1) * sizeof(void*)) : NULL;
+    if (success && !dirs)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        success = false;
+    }
+
+    char name[PATH_MAX];
+    for (uint64_t i = 0; i < head.dirs && success; ++i)
+    {
+        dir_record stored;
+        success = fread(&stored, sizeof(stored), 1, in) == 1 && stored.parent <= i && stored.length < PATH_MAX &&
+                  fread(name, stored.length, 1, in) == 1;
+        if (!success)
+        {
+            fprintf(stderr, "Shard index %s is damaged\n", path);
+            break;
+        }
+        name[stored.length] = '\0';
+        success = (dirs[i] = enter(stored.parent ? dirs[stored.parent - 1] : NULL, name)) != NULL;
+    }
+
+    unsigned char digest[MAX_DIGEST];
+    for (uint64_t i = 0; i < head.files && success; ++i)
+    {
+        file_record stored;
+        success = fread(&stored, sizeof(stored), 1, in) == 1 && stored.dir <= head.dirs &&
+                  stored.length < PATH_MAX && fread(digest, head.digestSize, 1, in) == 1 &&
+                  fread(name, stored.length, 1, in) == 1;
+        if (!success)
+        {
+            fprintf(stderr, "Shard index %s is damaged\n", path);
+            break;
+        }
+        name[stored.length] = '\0';
+
+        // A file which changed before its shard could hash it cannot be vouched for
+        if (stored.flags & CHANGED)
+            continue;
+
+        memset(&sb, 0, sizeof(sb));
+        sb.st_size = stored.size;
+        sb.st_dev = stored.dev;
+        sb.st_ino = stored.ino;
+        sb.st_mtim.tv_sec = stored.mtime / 1000000000LL;
+        sb.st_mtim.tv_nsec = stored.mtime % 1000000000LL;
+        sb.st_ctim.tv_sec = stored.ctime / 1000000000LL;
+        sb.st_ctim.tv_nsec = stored.ctime % 1000000000LL;
+        success = fn(stored.dir ? dirs[stored.dir - 1] : NULL, name, &sb,
+                     stored.flags & HAS_DIGEST ? digest : NULL, i);
+    }
+
+    free(dirs);
+    fclose(in);
+    return success;
+}
+
+// Path of request file of an index, which caller frees
+static char *wantPath(const char *path)
+{
+    char *want = malloc(strlen(path) + sizeof(".want"));
+    if (!want)
+        fprintf(stderr, "Not enough memory!\n");
+    else
+        strcat(strcpy(want, path), ".want");
+    return want;
+}
+
+bool shard_want(const char *path, const uint64_t *records, size_t count)
+{
+    char *want = wantPath(path);
+    FILE *out = want ? fopen(want, "wb") : NULL;
+    if (!out)
+    {
+        if (want)
+            fprintf(stderr, "Unable to write %s: %s\n", want, strerror(errno));
+        free(want);
+        return false;
+    }
+    uint64_t total = count;
+    bool success = fwrite(WANT_MAGIC, 8, 1, out) == 1 && fwrite(&total, sizeof(total), 1, out) == 1 &&
+                   (!count || fwrite(records, sizeof(uint64_t), count, out) == count);
+    success = fclose(out) == 0 && success;
+    if (!success)
+        fprintf(stderr, "Unable to write %s\n", want);
+    free(want);
+    return success;
+}
+
+// A file a merge asked for, hashed in place within index held in memory
+typedef struct hash_task
+{
+    char *path;
+    unsigned char *record;
+    const engine *engine;
+} hash_task;
+
+static void hashTask(void *arg)
+{
+    hash_task *task = arg;
+    file_record stored;
+    memcpy(&stored, task->record, sizeof(stored));
+
+    // Digest only vouches for file as indexed, so a file changed since, or a same path now on another device, is
+    // marked instead of hashed
+    struct stat sb;
+    bool same = lstat(task->path, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_dev == stored.dev &&
+                sb.st_ino == stored.ino && sb.st_size == stored.size &&
+                sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec == stored.mtime &&
+                sb.st_ctim.tv_sec * 1000000000LL + sb.st_ctim.tv_nsec == stored.ctime;
+    if (same && digest_mapped(task->path, task->engine, 1, task->record + sizeof(stored)) == 0)
+        stored.flags |= HAS_DIGEST;
+    else
+        stored.flags |= CHANGED;
+    memcpy(task->record, &stored, sizeof(stored));
+}
+
+bool shard_hash(const char *path, int threads)
+{
+    char *want = wantPath(path);
+    FILE *in = want ? fopen(want, "rb") : NULL;
+    if (!in)
+    {
+        if (want)
+            fprintf(stderr, "No digests are asked of %s\n", path);
+        free(want);
+        return want != NULL;
+    }
+    char magic[8];
+    uint64_t count = 0;
+    uint64_t *records = NULL;
+    struct stat sb;
+    bool success = fstat(fileno(in), &sb) == 0 && fread(magic, 8, 1, in) == 1 &&
+                   memcmp(magic, WANT_MAGIC, 8) == 0 && fread(&count, sizeof(count), 1, in) == 1 &&
+                   count <= (uint64_t)sb.st_size / sizeof(uint64_t) &&
+                   (records = malloc((count ? count : 1) * sizeof(uint64_t))) &&
+                   (!count || fread(records, sizeof(uint64_t), count, in) == count);
+    fclose(in);
+    if (!success)
+        fprintf(stderr, "Unable to read %s\n", want);
+
+    // Whole index is held in memory and written back with digests filled in
+    unsigned char *data = NULL;
+    size_t size = 0;
+    if (success)
+    {
+        in = fopen(path, "rb");
+        success = in && fstat(fileno(in), &sb) == 0 && (size = sb.st_size) >= sizeof(shard_header) &&
+                  (data = malloc(size)) && fread(data, size, 1, in) == 1;
+        if (in)
+            fclose(in);
+        if (!success)
+            fprintf(stderr, "Unable to read shard index %s\n", path);
+    }
+    shard_header head;
+    const engine *chosen = NULL;
+    if (success)
+    {
+        memcpy(&head, data, sizeof(head));
+        success = validHeader(&head, path) && (chosen = engine_find(head.engine)) && chosen->size == head.digestSize;
+        if (validHeader(&head, path) && !chosen)
+            fprintf(stderr, "Unknown hash %s in %s\n", head.engine, path);
+        success = success && validCounts(&head, size, path);
+    }
+
+    // Rebuilds directory table so that paths of wanted files can be formed
+    arena *names = success ? arena_create() : NULL;
+    dir **dirs = success ? malloc((head.dirs ? head.dirs : 1) * sizeof(dir*)) : NULL;
+    size_t *offsets = success ? malloc((head.files ? head.files : 1) * sizeof(size_t)) : NULL;
+    if (success && (!names || !dirs || !offsets))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        success = false;
+    }
+    size_t at = sizeof(shard_header);
+    char name[PATH_MAX];
+    for (uint64_t i = 0; i < head.dirs && success; ++i)
+    {
+        dir_record stored;
+        success = at + sizeof(stored) <= size;
+        if (success)
+            memcpy(&stored, data + at, sizeof(stored));
+        success = success && stored.parent <= i && stored.length < PATH_MAX &&
+                  at + sizeof(stored) + stored.length <= size;
+        if (!success)
+        {
+            fprintf(stderr, "Shard index %s is damaged\n", path);
+            break;
+        }
+        memcpy(name, data + at + sizeof(stored), stored.length);
+        name[stored.length] = '\0';
+        success = (dirs[i] = dir_add(names, stored.parent ? dirs[stored.parent - 1] : NULL, name)) != NULL;
+        at += sizeof(stored) + stored.length;
+    }
+    for (uint64_t i = 0; i < head.files && success; ++i)
+    {
+        file_record stored;
+        success = at + sizeof(stored) <= size;
+        if (success)
+            memcpy(&stored, data + at, sizeof(stored));
+        success = success && stored.dir <= head.dirs && stored.length < PATH_MAX &&
+                  at + sizeof(stored) + head.digestSize + stored.length <= size;
+        if (!success)
+        {
+            fprintf(stderr, "Shard index %s is damaged\n", path);
+            break;
+        }
+        offsets[i] = at;
+        at += sizeof(stored) + head.digestSize + stored.length;
+    }
+
+    hash_task *tasks = success ? calloc(count ? count : 1, sizeof(hash_task)) : NULL;
+    pool *workers = tasks ? pool_create(threads, count ? count : 1) : NULL;
+    if (success && !workers)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        success = false;
+    }
+    size_t queued = 0;
+    for (uint64_t i = 0; i < count && success; ++i)
+    {
+        if (records[i] >= head.files)
+            continue;
+        file_record stored;
+        unsigned char *record = data + offsets[records[i]];
+        memcpy(&stored, record, sizeof(stored));
+        memcpy(name, record + sizeof(stored) + head.digestSize, stored.length);
+        name[stored.length] = '\0';
+        hash_task *task = &tasks[queued];
+        task->record = record;
+        task->engine = chosen;
+        success = (task->path = path_build(stored.dir ? dirs[stored.dir - 1] : NULL, name)) != NULL;
+        if (success)
+            pool_submit(workers, hashTask, &tasks[queued++]);
+    }
+    if (workers)
+    {
+        pool_wait(workers);
+        pool_destroy(workers);
+    }
+
+    unsigned int hashed = 0, changed = 0;
+    for (size_t i = 0; i < queued; ++i)
+    {
+        file_record stored;
+        memcpy(&stored, tasks[i].record, sizeof(stored));
+        hashed += (stored.flags & HAS_DIGEST) != 0;
+        changed += (stored.flags & CHANGED) != 0;
+        free(tasks[i].path);
+    }
+
+    // Replaced atomically so that a failed run leaves index as it was
+    if (success)
+    {
+        size_t length = strlen(path) + 32;
+        char *temp = malloc(length);
+        FILE *out = NULL;
+        if (temp)
+        {
+            snprintf(temp, length, "%s.%ld.tmp", path, (long)getpid());
+            out = fopen(temp, "wb");
+        }
+        success = out && fwrite(data, size, 1, out) == 1;
+        success = success && fflush(out) == 0 && fsync(fileno(out)) == 0;
+        success = (!out || fclose(out) == 0) && success;
+        success = success && rename(temp, path) == 0;
+        if (!success)
+        {
+            fprintf(stderr, "Unable to write shard index %s\n", path);
+            if (temp)
+                unlink(temp);
+        }
+        free(temp);
+    }
+    if (success)
+    {
+        unlink(want);
+        printf("Hashed %u files of %s", hashed, path);
+        if (changed)
+            printf(", %u files changed since scan are left out of merges", changed);
+        printf("\n");
+    }
+
+    free(tasks);
+    free(offsets);
+    free(dirs);
+    if (names)
+        arena_destroy(names);
+    free(data);
+    free(records);
+    free(want);
+    return success;
+}
@@ -0,0 +1,36 @@
+// Contains declaration of shard indexes, which let roots be scanned by separate processes or hosts and merged later
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Called for every directory of an index, parents first, with what it returned for parent, NULL for roots.
+// Returns what entries of directory are handed, NULL when out of memory.
+typedef void *(*shard_dir_fn)(void *parent, const char *name);
+
+// Called for every file of an index with what shard_dir_fn returned for its directory, its digest if shard
+// knows it, and its no within index
+typedef bool (*shard_file_fn)(void *dir, const char *name, const struct stat *sb, const unsigned char *digest,
+                              uint64_t record);
+
+// Writes every file of size index as a shard index, with directories once each and digests the hash cache holds
+bool shard_write(const char *path);
+
+// Copies name of host an index was made on to label, false if path is not a shard index
+bool shard_label(const char *path, char *label, size_t size);
+
+// Reads a shard index made with engine of config, handing its directories and files to callbacks
+bool shard_read(const char *path, shard_dir_fn enter, shard_file_fn fn);
+
+// Asks shard owning an index for digests of given records, through a request file next to index
+bool shard_want(const char *path, const uint64_t *records, size_t count);
+
+// Computes digests a merge asked for with given no of threads and adds them to index, files changed since scan
+// are marked so that merges leave them out
+bool shard_hash(const char *path, int threads);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "sizeindex.h"
+
+// Independent tables, so that walkers loading files of different sizes rarely wait on each other
+#define SHARDS 64
+
+// Slots a shard starts with, always a power of 2
+#define INITIAL_SLOTS 256
+
+// Open addressing table with linear probing, kept at most half full
+typedef struct shard
+{
+    pthread_mutex_t lock;
+    size_group *slots;
+    size_t capacity;
+    size_t used;
+} shard;
+
+static shard shards[SHARDS];
+
+// Spreads sizes over shards and slots, common small sizes would otherwise crowd a few of them
+static inline uint64_t mix(off_t size)
+{
+    uint64_t h = (uint64_t)size;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Slot holding given size, or empty slot where it belongs
+static size_group *probe(size_group *slots, size_t capacity, off_t size, uint64_t h)
+{
+    size_t mask = capacity - 1;
+    for (size_t i = (h / SHARDS) & mask;; i = (i + 1) & mask)
+        if (!slots[i].count || slots[i].size == size)
+            return &slots[i];
+}
+
+static bool grow(shard *table)
+{
+    size_t capacity = table->capacity ? table->capacity * 2 : INITIAL_SLOTS;
+    size_group *slots = calloc(capacity, sizeof(size_group));
+    if (!slots)
+        return false;
+    for (size_t i = 0; i < table->capacity; ++i)
+        if (table->slots[i].count)
+            *probe(slots, capacity, table->slots[i].size, mix(table->slots[i].size)) = table->slots[i];
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return true;
+}
+
+// Makes room for one more member, a lone file moves out of its slot into an array
+static bool reserve(size_group *group)
+{
+    if (group->count == 1)
+    {
+        struct node **members = malloc(4 * sizeof(struct node*));
+        if (!members)
+            return false;
+        members[0] = group->one;
+        group->members = members;
+        group->capacity = 4;
+    }
+    else if (group->count == group->capacity)
+    {
+        struct node **members = realloc(group->members, group->capacity * 2 * sizeof(struct node*));
+        if (!members)
+            return false;
+        group->members = members;
+        group->capacity *= 2;
+    }
+    return true;
+}
+
+void sizeindex_init(void)
+{
+    for (int i = 0; i < SHARDS; ++i)
+        pthread_mutex_init(&shards[i].lock, NULL);
+}
+
+bool sizeindex_add(struct node *file, off_t size)
+{
+    uint64_t h = mix(size);
+    shard *table = &shards[h % SHARDS];
+    bool success = true;
+
+    pthread_mutex_lock(&table->lock);
+    if (2 * (table->used + 1) > table->capacity && !grow(table))
+    {
+        success = false;
+    }
+    else
+    {
+        size_group *group = probe(table->slots, table->capacity, size, h);
+        if (!group->count)
+        {
+            group->size = size;
+            group->count = 1;
+            group->capacity = 1;
+            group->one = file;
+            ++table->used;
+        }
+        else if (reserve(group))
+        {
+            group->members[group->count++] = file;
+        }
+        else
+        {
+            success = false;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    if (!success)
+        fprintf(stderr, "Not enough memory!\n");
+    return success;
+}
+
+size_group *sizeindex_next(size_cursor *cursor)
+{
+    for (; cursor->shard < SHARDS; ++cursor->shard, cursor->slot = 0)
+    {
+        shard *table = &shards[cursor->shard];
+        while (cursor->slot < table->capacity)
+        {
+            size_group *group = &table->slots[cursor->slot++];
+            if (group->count)
+                return group;
+        }
+    }
+    return NULL;
+}
+
+void sizeindex_clear(void)
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard *table = &shards[i];
+        for (size_t j = 0; j < table->capacity; ++j)
+            if (table->slots[j].count > 1)
+                free(table->slots[j].members);
+        free(table->slots);
+        table->slots = NULL;
+        table->capacity = table->used = 0;
+    }
+}
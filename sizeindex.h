@@ -0,0 +1,52 @@
+// Contains declaration of index grouping files by exact size while walkers load them
+
+#ifndef SIZEINDEX_H
+#define SIZEINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct node;
+
+// Files of one size, a lone file is held inline so that a unique size needs no member array
+typedef struct size_group
+{
+    off_t size;
+
+    // No of files, 0 for an empty slot
+    unsigned int count;
+    unsigned int capacity;
+    union
+    {
+        struct node *one;
+        struct node **members;
+    };
+} size_group;
+
+// Position of a walk over all groups, start it zeroed
+typedef struct size_cursor
+{
+    size_t shard;
+    size_t slot;
+} size_cursor;
+
+// Members of a group, stored contiguously
+static inline struct node **size_members(size_group *group)
+{
+    return group->count == 1 ? &group->one : group->members;
+}
+
+// Initializes locks of index
+void sizeindex_init(void);
+
+// Adds a file to group of its size, safe to call from several threads, false when out of memory
+bool sizeindex_add(struct node *file, off_t size);
+
+// Next group in no particular order, NULL after last one, index must not change during walk
+size_group *sizeindex_next(size_cursor *cursor);
+
+// Frees every group, files themselves are left alone
+void sizeindex_clear(void);
+
+#endif
@@ -0,0 +1,616 @@
+// GNU extensions, for fallocate()
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "spill.h"
+
+// Read buffer of every run being merged, and buffer merged runs are written out through
+#define MERGE_BUFFER (64 * 1024)
+
+// Least a walker thread buffers, which holds a few records of longest name
+#define MIN_BUFFER (16 * 1024)
+
+// Records handed to one pwritev() call
+#define WRITE_BATCH 64
+
+// Records of one walker thread, cut into a sorted run whenever it fills up
+typedef struct buffer
+{
+    char *data;
+    size_t used;
+    size_t count;
+
+    // Records in order of size, only built once buffer is cut
+    spill_record **sorted;
+} buffer;
+
+// Stretch of scratch file holding a sorted run
+typedef struct run
+{
+    off_t offset;
+    off_t length;
+} run;
+
+// A run being merged, read back from scratch file or from a buffer still in memory
+typedef struct cursor
+{
+    spill_record *current;
+
+    // Run is read from offset up to end through data, whose bytes from next up to filled are not handed out yet
+    off_t offset;
+    off_t end;
+    char *data;
+    size_t next;
+    size_t filled;
+
+    buffer *memory;
+    size_t index;
+} cursor;
+
+static const char *scratchDir;
+static size_t budgetBytes;
+static size_t perThread;
+
+static buffer **buffers;
+static size_t nbuffers;
+static __thread buffer *local;
+
+// Every run goes to one unlinked scratch file, so that descriptors never grow with no of runs
+static int scratchFd = -1;
+static off_t scratchEnd;
+static run *runs;
+static size_t nruns;
+static size_t runCapacity;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static cursor *cursors;
+static size_t ncursors;
+static size_t *heap;
+static size_t heapSize;
+
+// Group handed out by spill_next(), records live in one block and are pointed at once it stops growing
+static char *groupData;
+static size_t groupCapacity;
+static size_t *groupOffsets;
+static spill_record **groupRecords;
+static size_t groupSlots;
+
+// Records are kept 8 byte aligned, in memory and on disk alike
+static size_t recordSize(size_t length)
+{
+    return (offsetof(spill_record, name) + length + 1 + 7) & ~(size_t)7;
+}
+
+static int bySize(const void *a, const void *b)
+{
+    const spill_record *x = *(spill_record * const *)a, *y = *(spill_record * const *)b;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+bool spill_open(const char *scratch, size_t budget, int threads)
+{
+    scratchDir = scratch;
+    budgetBytes = budget;
+    perThread = budget / (threads > 0 ? threads : 1);
+    if (perThread < MIN_BUFFER)
+        perThread = MIN_BUFFER;
+    return true;
+}
+
+// Sorts a buffer's records by size, false when out of memory
+static bool sortBuffer(buffer *full)
+{
+    free(full->sorted);
+    full->sorted = malloc((full->count ? full->count : 1) * sizeof(spill_record*));
+    if (!full->sorted)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    for (size_t i = 0, offset = 0; i < full->count; ++i)
+    {
+        full->sorted[i] = (spill_record *)(full->data + offset);
+        offset += recordSize(full->sorted[i]->length);
+    }
+    qsort(full->sorted, full->count, sizeof(spill_record*), bySize);
+    return true;
+}
+
+// Creates scratch file on first run, unlinked right away so that it never outlives scan, called with lock held
+static bool openScratch(void)
+{
+    if (scratchFd != -1)
+        return true;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/dupsfinder-%d.runs", scratchDir, (int)getpid());
+    scratchFd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (scratchFd == -1)
+    {
+        fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    unlink(path);
+    return true;
+}
+
+// Sets aside room for a run at end of scratch file, called with lock held
+static bool addRun(off_t length, off_t *offset)
+{
+    if (nruns == runCapacity)
+    {
+        size_t capacity = runCapacity ? runCapacity * 2 : 64;
+        run *grown = realloc(runs, capacity * sizeof(run));
+        if (!grown)
+        {
+            fprintf(stderr, "Not enough memory!\n");
+            return false;
+        }
+        runs = grown;
+        runCapacity = capacity;
+    }
+    *offset = scratchEnd;
+    runs[nruns++] = (run){scratchEnd, length};
+    scratchEnd += length;
+    return true;
+}
+
+// Writes a batch of records whole at offset, carrying on after a short write
+static bool writeFully(struct iovec *batch, int count, off_t offset)
+{
+    while (count)
+    {
+        ssize_t written = pwritev(scratchFd, batch, count, offset);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        offset += written;
+        while (count && (size_t)written >= batch->iov_len)
+        {
+            written -= batch->iov_len;
+            ++batch;
+            --count;
+        }
+        if (count)
+        {
+            batch->iov_base = (char *)batch->iov_base + written;
+            batch->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// Writes a full buffer as a sorted run at a stretch of scratch file of its own
+static bool cutRun(buffer *full)
+{
+    if (!sortBuffer(full))
+        return false;
+
+    off_t offset = 0;
+    pthread_mutex_lock(&lock);
+    bool reserved = openScratch() && addRun(full->used, &offset);
+    pthread_mutex_unlock(&lock);
+    if (!reserved)
+        return false;
+
+    // Records go out straight from buffer in sorted order, without being copied
+    struct iovec batch[WRITE_BATCH];
+    for (size_t i = 0; i < full->count;)
+    {
+        int count = 0;
+        size_t bytes = 0;
+        for (; count < WRITE_BATCH && i < full->count; ++count, ++i)
+        {
+            batch[count].iov_base = full->sorted[i];
+            batch[count].iov_len = recordSize(full->sorted[i]->length);
+            bytes += batch[count].iov_len;
+        }
+        if (!writeFully(batch, count, offset))
+        {
+            fprintf(stderr, "Unable to write to %s: %s\n", scratchDir, strerror(errno));
+            return false;
+        }
+        offset += bytes;
+    }
+    full->used = full->count = 0;
+    return true;
+}
+
+// Buffer of calling thread, made on first use
+static buffer *threadBuffer(void)
+{
+    if (local)
+        return local;
+
+    buffer *fresh = calloc(1, sizeof(buffer));
+    if (fresh && !(fresh->data = malloc(perThread)))
+    {
+        free(fresh);
+        fresh = NULL;
+    }
+    pthread_mutex_lock(&lock);
+    buffer **grown = fresh ? realloc(buffers, (nbuffers + 1) * sizeof(buffer*)) : NULL;
+    if (grown)
+    {
+        buffers = grown;
+        buffers[nbuffers++] = fresh;
+    }
+    pthread_mutex_unlock(&lock);
+    if (!grown)
+    {
+        if (fresh)
+            free(fresh->data);
+        free(fresh);
+        return NULL;
+    }
+    return local = fresh;
+}
+
+bool spill_add(const void *parent, const char *name, const struct stat *sb)
+{
+    size_t length = strlen(name);
+    if (length >= PATH_MAX)
+    {
+        fprintf(stderr, "Path too long: %s\n", name);
+        return false;
+    }
+    buffer *own = threadBuffer();
+    if (!own)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+
+    // Budget covers records along with pointer each one needs while sorted
+    size_t size = recordSize(length);
+    if (own->used + size + (own->count + 1) * sizeof(spill_record*) > perThread && !cutRun(own))
+        return false;
+
+    spill_record *record = (spill_record *)(own->data + own->used);
+    record->size = sb->st_size;
+    record->dev = sb->st_dev;
+    record->ino = sb->st_ino;
+    record->mtime = sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+    record->ctime = sb->st_ctim.tv_sec * 1000000000LL + sb->st_ctim.tv_nsec;
+    record->parent = parent;
+    record->length = length;
+    memcpy(record->name, name, length + 1);
+    own->used += size;
+    ++own->count;
+    return true;
+}
+
+static void freeBuffers(void)
+{
+    for (size_t i = 0; i < nbuffers; ++i)
+    {
+        free(buffers[i]->data);
+        free(buffers[i]->sorted);
+        free(buffers[i]);
+    }
+    free(buffers);
+    buffers = NULL;
+    nbuffers = 0;
+    local = NULL;
+}
+
+// Reads more of a run until at least need bytes of it are unread, false once run ends first or on failure
+static bool fill(cursor *at, size_t need, bool *failed)
+{
+    if (at->filled - at->next >= need)
+        return true;
+
+    // Bytes left over move to front, records stay aligned as every one of them is a multiple of 8 long
+    memmove(at->data, at->data + at->next, at->filled - at->next);
+    at->filled -= at->next;
+    at->next = 0;
+    while (at->filled < need && at->offset < at->end)
+    {
+        size_t room = MERGE_BUFFER - at->filled;
+        if ((off_t)room > at->end - at->offset)
+            room = at->end - at->offset;
+        ssize_t bytesRead = pread(scratchFd, at->data + at->filled, room, at->offset);
+        if (bytesRead == -1 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+        {
+            fprintf(stderr, "Unable to read from %s: %s\n", scratchDir, bytesRead ? strerror(errno) : "end of file");
+            *failed = true;
+            return false;
+        }
+        at->filled += bytesRead;
+        at->offset += bytesRead;
+    }
+    return at->filled >= need;
+}
+
+// Moves cursor to its next record, false once run is over or unreadable
+static bool advance(cursor *at, bool *failed)
+{
+    if (at->memory)
+    {
+        if (at->index == at->memory->count)
+            return false;
+        at->current = at->memory->sorted[at->index++];
+        return true;
+    }
+
+    // A run ends on boundary of a record, anything else is damage
+    size_t header = offsetof(spill_record, name);
+    if (!fill(at, header, failed))
+    {
+        if (!*failed && at->filled != at->next)
+        {
+            fprintf(stderr, "Unable to read from %s\n", scratchDir);
+            *failed = true;
+        }
+        return false;
+    }
+    unsigned int length = ((spill_record *)(at->data + at->next))->length;
+    if (length >= PATH_MAX || !fill(at, recordSize(length), failed))
+    {
+        if (!*failed)
+            fprintf(stderr, "Unable to read from %s\n", scratchDir);
+        *failed = true;
+        return false;
+    }
+    at->current = (spill_record *)(at->data + at->next);
+    at->next += recordSize(length);
+    return true;
+}
+
+static bool smaller(size_t a, size_t b)
+{
+    return cursors[heap[a]].current->size < cursors[heap[b]].current->size;
+}
+
+// Restores heap order below a slot whose record grew
+static void siftDown(size_t slot)
+{
+    while (true)
+    {
+        size_t least = slot, left = 2 * slot + 1, right = left + 1;
+        if (left < heapSize && smaller(left, least))
+            least = left;
+        if (right < heapSize && smaller(right, least))
+            least = right;
+        if (least == slot)
+            return;
+        size_t swapped = heap[slot];
+        heap[slot] = heap[least];
+        heap[least] = swapped;
+        slot = least;
+    }
+}
+
+// Moves cursor on top of heap to its next record, dropping it once its run is over
+static void pop(bool *failed)
+{
+    if (!advance(&cursors[heap[0]], failed))
+        heap[0] = heap[--heapSize];
+    siftDown(0);
+}
+
+// Starts merging first count runs, or every buffer still in memory when there are no runs
+static bool startMerge(size_t count, bool *failed)
+{
+    heapSize = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        cursor *at = &cursors[i];
+        if (nruns)
+        {
+            at->memory = NULL;
+            at->offset = runs[i].offset;
+            at->end = runs[i].offset + runs[i].length;
+            at->next = at->filled = 0;
+        }
+        else
+        {
+            at->memory = buffers[i];
+            at->index = 0;
+            if (!sortBuffer(at->memory))
+                return false;
+        }
+        if (advance(at, failed))
+            heap[heapSize++] = i;
+        else if (*failed)
+            return false;
+    }
+    for (size_t slot = heapSize; slot-- > 0;)
+        siftDown(slot);
+    return true;
+}
+
+// Merges first count runs into one at end of scratch file, which takes their place at end of queue of runs
+static bool mergeRuns(size_t count, char *output)
+{
+    bool failed = false;
+    if (!startMerge(count, &failed))
+        return false;
+
+    off_t start = scratchEnd, offset = start;
+    size_t filled = 0;
+    struct iovec chunk;
+    while (heapSize || filled)
+    {
+        size_t size = heapSize ? recordSize(cursors[heap[0]].current->length) : 0;
+        if (!heapSize || filled + size > MERGE_BUFFER)
+        {
+            chunk = (struct iovec){output, filled};
+            if (!writeFully(&chunk, 1, offset))
+            {
+                fprintf(stderr, "Unable to write to %s: %s\n", scratchDir, strerror(errno));
+                return false;
+            }
+            offset += filled;
+            filled = 0;
+            continue;
+        }
+        memcpy(output + filled, cursors[heap[0]].current, size);
+        filled += size;
+        pop(&failed);
+        if (failed)
+            return false;
+    }
+
+    // Room runs merged took is handed back where file system can punch holes, so scratch disk holds about one copy
+    for (size_t i = 0; i < count; ++i)
+        fallocate(scratchFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, runs[i].offset, runs[i].length);
+    memmove(runs, runs + count, (nruns - count) * sizeof(run));
+    nruns -= count;
+    runs[nruns++] = (run){start, offset - start};
+    scratchEnd = offset;
+    return true;
+}
+
+bool spill_merge(void)
+{
+    // Everything found fit in buffers, which are then merged straight from memory
+    if (!nruns)
+    {
+        cursors = calloc(nbuffers ? nbuffers : 1, sizeof(cursor));
+        heap = malloc((nbuffers ? nbuffers : 1) * sizeof(size_t));
+        if (!cursors || !heap)
+        {
+            fprintf(stderr, "Not enough memory!\n");
+            return false;
+        }
+        bool failed = false;
+        return startMerge(nbuffers, &failed);
+    }
+
+    // Otherwise buffers left over join runs on disk, and give their memory over to reading runs back
+    for (size_t i = 0; i < nbuffers; ++i)
+        if (buffers[i]->count && !cutRun(buffers[i]))
+            return false;
+    freeBuffers();
+
+    // Every run merged at once takes a read buffer out of budget, besides one a pass writes through, so that
+    // many runs are merged in several passes, each merging oldest runs into a longer one
+    size_t fanIn = budgetBytes / MERGE_BUFFER > 3 ? budgetBytes / MERGE_BUFFER - 1 : 2;
+    size_t slots = nruns < fanIn ? nruns : fanIn;
+    cursors = calloc(slots, sizeof(cursor));
+    heap = malloc(slots * sizeof(size_t));
+    ncursors = cursors ? slots : 0;
+    bool ready = cursors && heap;
+    for (size_t i = 0; i < ncursors && ready; ++i)
+        ready = (cursors[i].data = malloc(MERGE_BUFFER)) != NULL;
+    char *output = ready && nruns > fanIn ? malloc(MERGE_BUFFER) : NULL;
+    if (!ready || (nruns > fanIn && !output))
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(output);
+        return false;
+    }
+    while (ready && nruns > fanIn)
+        ready = mergeRuns(fanIn, output);
+    free(output);
+
+    bool failed = false;
+    return ready && startMerge(nruns, &failed);
+}
+
+// Copies a record into group being built
+static bool keep(const spill_record *record, size_t count, size_t *used)
+{
+    size_t size = recordSize(record->length);
+    if (*used + size > groupCapacity)
+    {
+        size_t capacity = groupCapacity ? groupCapacity : MERGE_BUFFER;
+        while (*used + size > capacity)
+            capacity *= 2;
+        char *grown = realloc(groupData, capacity);
+        if (!grown)
+            return false;
+        groupData = grown;
+        groupCapacity = capacity;
+    }
+    if (count == groupSlots)
+    {
+        size_t slots = groupSlots ? groupSlots * 2 : 64;
+        size_t *offsets = realloc(groupOffsets, slots * sizeof(size_t));
+        if (offsets)
+            groupOffsets = offsets;
+        spill_record **records = offsets ? realloc(groupRecords, slots * sizeof(spill_record*)) : NULL;
+        if (!records)
+            return false;
+        groupRecords = records;
+        groupSlots = slots;
+    }
+    memcpy(groupData + *used, record, size);
+    groupOffsets[count] = *used;
+    *used += size;
+    return true;
+}
+
+bool spill_next(spill_group *group, bool *failed)
+{
+    *failed = false;
+    group->count = 0;
+    group->skipped = 0;
+    while (heapSize)
+    {
+        off_t size = cursors[heap[0]].current->size;
+        size_t count = 0, used = 0;
+        while (heapSize && cursors[heap[0]].current->size == size)
+        {
+            if (!keep(cursors[heap[0]].current, count++, &used))
+            {
+                fprintf(stderr, "Not enough memory!\n");
+                *failed = true;
+                return false;
+            }
+            pop(failed);
+            if (*failed)
+                return false;
+        }
+
+        if (count < 2)
+        {
+            group->skipped += count;
+            continue;
+        }
+        for (size_t i = 0; i < count; ++i)
+            groupRecords[i] = (spill_record *)(groupData + groupOffsets[i]);
+        group->records = groupRecords;
+        group->count = count;
+        return true;
+    }
+    return false;
+}
+
+void spill_close(void)
+{
+    if (scratchFd != -1)
+        close(scratchFd);
+    for (size_t i = 0; i < ncursors; ++i)
+        free(cursors[i].data);
+    freeBuffers();
+    free(runs);
+    free(cursors);
+    free(heap);
+    free(groupData);
+    free(groupOffsets);
+    free(groupRecords);
+    scratchFd = -1;
+    scratchEnd = 0;
+    runs = NULL;
+    cursors = NULL;
+    heap = NULL;
+    groupData = NULL;
+    groupOffsets = NULL;
+    groupRecords = NULL;
+    nruns = runCapacity = ncursors = heapSize = groupCapacity = groupSlots = 0;
+}
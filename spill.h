@@ -0,0 +1,57 @@
+// Contains declaration of external sort which keeps files found by walk on scratch disk and hands them back by size
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// What is kept of a file until its size comes up, followed by its name
+typedef struct spill_record
+{
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    long long mtime;
+    long long ctime;
+
+    // Directory of file as walker handed it, which stays in memory
+    const void *parent;
+
+    // Bytes of name, without its terminating NUL which is stored too
+    unsigned int length;
+    char name[];
+} spill_record;
+
+// Files sharing a size, valid until next call to spill_next()
+typedef struct spill_group
+{
+    spill_record **records;
+    size_t count;
+
+    // Files of unique size passed over on way to this group
+    unsigned long long skipped;
+} spill_group;
+
+// Starts collecting records in buffers of about budget bytes across given no of threads, sorted runs of full
+// buffers go to one unlinked file in scratch directory. Merge later reads runs back within same budget.
+// False when out of memory.
+bool spill_open(const char *scratch, size_t budget, int threads);
+
+// Records a file, safe to call from several threads, false when it cannot be written
+bool spill_add(const void *parent, const char *name, const struct stat *sb);
+
+// Starts merging every run by size, after merging oldest runs into longer ones for as long as there are more of
+// them than budget reads back at once, false on failure
+bool spill_merge(void);
+
+// Fills group with next files sharing a size with at least one other, in ascending order of size.
+// False after last one, or on failure which is then already reported.
+bool spill_next(spill_group *group, bool *failed);
+
+// Closes scratch file and frees buffers
+void spill_close(void);
+
+#endif
@@ -3,11 +3,19 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "arena.h"
 #include "stack.h"
 
+stack *top = NULL;
+
+// Levels are carved out of an arena, released as a whole by empty()
+static arena *levels = NULL;
+
 int push(node* file, bool flag)
 {
-    stack *level = malloc(sizeof(stack));
+    if (!levels)
+        levels = arena_create();
+    stack *level = levels ? arena_alloc(levels, sizeof(stack)) : NULL;
     if (!level)
     {
         fprintf(stderr, "Not enough memory\n");
@@ -24,9 +32,7 @@ void pop(void)
 {
     if (!top)
         return;
-    stack *temp = top;
     top = top->next;
-    free(temp);
 }
 
 void print(void)
@@ -34,18 +40,21 @@ void print(void)
     stack *level = top;
     while(level)
     {
+        // Falls back to bare name when whole path cannot be rebuilt
+        char *path = nodePath(level->file);
+        const char *shown = path ? path : nodeName(level->file);
         if (level->isParent)
-            printf("\n\nDuplicate of %s is at: \n", level->file->path);
+            printf("\n\nDuplicate of %s is at: \n", shown);
         else
-            printf("%s\n", level->file->path);
+            printf("%s\n", shown);
+        free(path);
         level = level->next;
     }
 }
 
 void empty(void)
 {
-    while(top)
-    {
-        pop();
-    }
+    top = NULL;
+    arena_destroy(levels);
+    levels = NULL;
 }
\ No newline at end of file
@@ -12,7 +12,7 @@ typedef struct stack
     struct stack *next;
 } stack;
 
-stack *top;
+extern stack *top;
 
 int push(node*, bool);
 void pop(void);
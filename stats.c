@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "stats.h"
+
+// Histogram bucket 0 holds empty files, bucket k sizes from 2^(k-1) up to 2^k
+#define SIZE_BUCKETS 64
+
+typedef struct stage_stats
+{
+    char name[16];
+    double seconds;
+    unsigned long long filesIn;
+    unsigned long long filesOut;
+
+    // Updated by worker threads, relaxed since they are only read once stage is over
+    atomic_ullong opens;
+    atomic_ullong bytes;
+    atomic_ullong errors;
+} stage_stats;
+
+static stage_stats stages[MAX_STAT_STAGES];
+static int nstages;
+
+// Stage counters go to, the last one stays current after it ends so that stray counts are not lost, atomic since
+// progress reporter reads it while stages change
+static stage_stats *_Atomic current = &stages[0];
+static struct timespec started;
+
+static atomic_ullong sizes[SIZE_BUCKETS];
+
+// Set once an open() fails for want of descriptors
+static atomic_bool exhausted;
+
+void stats_begin(const char *name, unsigned long long filesIn)
+{
+    // A stage run again, like once per batch under a memory budget, adds to its earlier runs
+    int found = 0;
+    while (found < nstages && strcmp(stages[found].name, name) != 0)
+        ++found;
+    if (found == MAX_STAT_STAGES)
+        return;
+    if (found == nstages)
+        snprintf(stages[nstages++].name, sizeof(stages[0].name), "%s", name);
+    current = &stages[found];
+    current->filesIn += filesIn;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+}
+
+void stats_end(unsigned long long filesOut)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    current->seconds += (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+    current->filesOut += filesOut;
+}
+
+void stats_open(int error)
+{
+    atomic_fetch_add_explicit(&current->opens, 1, memory_order_relaxed);
+    if (error)
+        atomic_fetch_add_explicit(&current->errors, 1, memory_order_relaxed);
+    if (error == EMFILE || error == ENFILE)
+        atomic_store(&exhausted, true);
+}
+
+bool stats_exhausted(void)
+{
+    return atomic_load(&exhausted);
+}
+
+void stats_read(size_t bytes)
+{
+    atomic_fetch_add_explicit(&current->bytes, bytes, memory_order_relaxed);
+}
+
+void stats_error(void)
+{
+    atomic_fetch_add_explicit(&current->errors, 1, memory_order_relaxed);
+}
+
+unsigned long long stats_stage_bytes(void)
+{
+    return atomic_load_explicit(&current->bytes, memory_order_relaxed);
+}
+
+void stats_size(off_t size)
+{
+    int bucket = size > 0 ? 64 - __builtin_clzll((unsigned long long)size) : 0;
+    atomic_fetch_add_explicit(&sizes[bucket < SIZE_BUCKETS ? bucket : SIZE_BUCKETS - 1], 1, memory_order_relaxed);
+}
+
+bool stats_write(const char *path, const stats_totals *totals)
+{
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!out)
+    {
+        fprintf(stderr, "Unable to write stats to %s\n", path);
+        return false;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "{\"files\": %llu, \"duplicates\": %llu, \"duplicate_bytes\": %llu, \"linked\": %llu, "
+                 "\"peak_rss_kb\": %ld,\n \"stages\": [",
+            totals->files, totals->duplicates, totals->duplicateBytes, totals->linked, usage.ru_maxrss);
+    for (int i = 0; i < nstages; ++i)
+    {
+        const stage_stats *s = &stages[i];
+        fprintf(out, "%s\n  {\"name\": \"%s\", \"seconds\": %.6f, \"files_in\": %llu, \"files_out\": %llu, "
+                     "\"opens\": %llu, \"bytes_read\": %llu, \"errors\": %llu}",
+                i ? "," : "", s->name, s->seconds, s->filesIn, s->filesOut, atomic_load(&s->opens),
+                atomic_load(&s->bytes), atomic_load(&s->errors));
+    }
+
+    // Only sizes which occur are listed, each bucket by its smallest and largest size
+    fprintf(out, "],\n \"size_histogram\": [");
+    bool first = true;
+    for (int i = 0; i < SIZE_BUCKETS; ++i)
+    {
+        unsigned long long files = atomic_load(&sizes[i]);
+        if (!files)
+            continue;
+        unsigned long long low = i ? 1ULL << (i - 1) : 0, high = i ? (1ULL << (i - 1)) * 2 - 1 : 0;
+        fprintf(out, "%s\n  {\"min\": %llu, \"max\": %llu, \"files\": %llu}", first ? "" : ",", low, high, files);
+        first = false;
+    }
+    fprintf(out, "]}\n");
+
+    bool success = !ferror(out);
+    if (out != stdout)
+        success = fclose(out) == 0 && success;
+    else
+        fflush(out);
+    if (!success)
+        fprintf(stderr, "Unable to write stats to %s\n", path);
+    return success;
+}
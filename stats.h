@@ -0,0 +1,51 @@
+// Contains declaration of counters kept per stage of a scan and of their JSON report
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Most stages a scan goes through, walk, size, partial stages, digest and output
+#define MAX_STAT_STAGES 16
+
+// Outcome of whole scan, reported next to stages
+typedef struct stats_totals
+{
+    unsigned long long files;
+    unsigned long long duplicates;
+    unsigned long long duplicateBytes;
+    unsigned long long linked;
+} stats_totals;
+
+// Starts timing a stage, opens, reads and errors counted until next one go to it, a stage of a name already seen
+// adds to it
+void stats_begin(const char *name, unsigned long long filesIn);
+
+// Ends current stage with no of files it kept
+void stats_end(unsigned long long filesOut);
+
+// Counts an open() done by current stage along with errno it failed with, 0 if it did not, safe to call from
+// several threads
+void stats_open(int error);
+
+// Tells whether an open() failed as descriptors ran out, which leaves out a file that is readable otherwise
+bool stats_exhausted(void);
+
+// Counts bytes read by current stage, safe to call from several threads
+void stats_read(size_t bytes);
+
+// Counts a failed read or other error of current stage, safe to call from several threads
+void stats_error(void);
+
+// Bytes read so far by current stage, safe to call from any thread while it runs
+unsigned long long stats_stage_bytes(void);
+
+// Adds a file to histogram of sizes, safe to call from several threads
+void stats_size(off_t size);
+
+// Writes every stage, histogram and peak memory as JSON to a file, or stdout for -, false if it cannot be written
+bool stats_write(const char *path, const stats_totals *totals);
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Checks --dedupe on a loopback btrfs or XFS filesystem: every file keeps its content, and duplicates end up on same
+# extents as their keeper. Needs root along with mkfs.btrfs or mkfs.xfs, and is skipped otherwise.
+
+. tests/lib.sh
+for fs in btrfs xfs ""
+do
+    test -n "$fs" && command -v mkfs.$fs > /dev/null && break
+done
+if [ "$(id -u)" != 0 ] || [ -z "$fs" ]
+then
+    echo "skipped dedupe, needs root and mkfs.btrfs or mkfs.xfs"
+    exit 0
+fi
+
+image=$TEST_DIR/dedupe.img
+mnt=$TEST_DIR/dedupe.mnt
+mkdir -p "$mnt"
+truncate -s 2G "$image"
+mkfs.$fs -q "$image" > /dev/null || exit 1
+mount -o loop "$image" "$mnt" || exit 1
+trap 'umount "$mnt"; rm -f "$image"' EXIT
+
+# Files of several chunks each, so that every call covers only part of them
+bench/gentree -o "$mnt/tree" -n 60 --min-size 4096 --max-size 50331648 --dup 0.4 --header 0.2 --links 0 \
+    --depth 2 > /dev/null || exit 1
+sync
+inodes "$mnt/tree" > "$TEST_DIR/inodes"
+reference "$TEST_DIR/inodes" "$mnt/tree" > "$TEST_DIR/expected"
+find "$mnt/tree" -type f -print0 | xargs -0 sha256sum | sort > "$TEST_DIR/before"
+
+$BIN -q --no-cache --dedupe "$mnt/tree" > "$TEST_DIR/log" 2>&1
+grep Deduplicated "$TEST_DIR/log"
+sync
+
+find "$mnt/tree" -type f -print0 | xargs -0 sha256sum | sort > "$TEST_DIR/after"
+same "contents kept" "$TEST_DIR/after" "$TEST_DIR/before"
+
+# Physical offsets of all extents of a file, same for every member of a group once it is shared
+awk '{ print $2, $1 }' "$TEST_DIR/inodes" | sort > "$TEST_DIR/paths"
+tr ',' '\n' < "$TEST_DIR/expected" | while read -r node
+do
+    path=$(awk -v node="$node" '$1 == node { print $2; exit }' "$TEST_DIR/paths")
+    echo "$node $(filefrag -v "$path" | awk '/^ *[0-9]+:/ { sub(/\.\..*/, "", $4); printf "%s ", $4 }')"
+done > "$TEST_DIR/extents"
+awk 'NR == FNR { extents[$1] = $0; sub(/^[^ ]* /, "", extents[$1]); next }
+     { n = split($0, f, ","); for (i = 2; i <= n; ++i) if (extents[f[i]] != extents[f[1]]) print "unshared", f[i] }' \
+    "$TEST_DIR/extents" "$TEST_DIR/expected" > "$TEST_DIR/unshared"
+same "extents shared" "$TEST_DIR/unshared" /dev/null
+
+exit $failures
@@ -0,0 +1,58 @@
+# Helpers shared by test scripts, sourced from root of repository
+
+BIN=${BIN:-./dupsfinder}
+TEST_DIR=${TEST_DIR:-/tmp/dupsfinder-test}
+failures=0
+
+# Generates tree $1 once with bench/gentree and given options, same options always give same tree
+tree()
+{
+    name=$1
+    shift
+    mkdir -p "$TEST_DIR"
+    test -d "$TEST_DIR/$name" || bench/gentree -o "$TEST_DIR/$name" "$@" > /dev/null
+}
+
+# Inode of every file under roots, as "path dev:ino" lines
+inodes()
+{
+    find "$@" -type f -printf '%p %D:%i\n'
+}
+
+# Turns NUL delimited groups on stdin into one sorted line of inodes per group, files of roots listed in $1
+groups()
+{
+    tr '\0' '\n' | awk -v list="$1" '
+        BEGIN { while ((getline line < list) > 0) { split(line, f, " "); inode[f[1]] = f[2] } }
+        $0 == "" { print group; group = ""; next }
+        { group = group (group == "" ? "" : ",") inode[$0] }' |
+    awk -F, '{ n = split($0, f, ","); for (i = 1; i <= n; ++i) for (j = i + 1; j <= n; ++j) if (f[j] < f[i]) { t = f[i]; f[i] = f[j]; f[j] = t }
+               line = f[1]; for (i = 2; i <= n; ++i) line = line "," f[i]; print line }' | sort
+}
+
+# Groups of distinct inodes sharing a sha256 under roots, in same form as groups()
+reference()
+{
+    list=$1
+    shift
+    find "$@" -type f -print0 | xargs -0 sha256sum | awk -v list="$list" '
+        BEGIN { while ((getline line < list) > 0) { split(line, f, " "); inode[f[1]] = f[2] } }
+        { path = substr($0, 67); node = inode[path]
+          if (!((node, $1) in seen)) { seen[node, $1] = 1; members[$1] = members[$1] (members[$1] == "" ? "" : ",") node; ++count[$1] } }
+        END { for (h in members) if (count[h] > 1) print members[h] }' |
+    awk -F, '{ n = split($0, f, ","); for (i = 1; i <= n; ++i) for (j = i + 1; j <= n; ++j) if (f[j] < f[i]) { t = f[i]; f[i] = f[j]; f[j] = t }
+               line = f[1]; for (i = 2; i <= n; ++i) line = line "," f[i]; print line }' | sort
+}
+
+# Reports whether $2 holds same groups as $3 under label $1
+same()
+{
+    if cmp -s "$2" "$3"
+    then
+        echo "ok      $1 ($(wc -l < "$2") groups)"
+    else
+        echo "FAILED  $1"
+        diff "$2" "$3" | head -5
+        failures=$((failures + 1))
+    fi
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Checks that every read mode, hash, stage chain and memory budget finds same duplicates as sha256sum does
+
+. tests/lib.sh
+set -e
+tree modes -n 4000 --max-size 262144 --dup 0.2 --header 0.1 --links 0.02
+tree large -n 40 --min-size 1048576 --max-size 33554432 --dup 0.3 --header 0.3 --depth 1
+ROOTS="$TEST_DIR/modes $TEST_DIR/large"
+inodes $ROOTS > "$TEST_DIR/inodes"
+reference "$TEST_DIR/inodes" $ROOTS > "$TEST_DIR/expected"
+set +e
+
+check()
+{
+    $BIN -q --no-cache --format nul "$@" $ROOTS | groups "$TEST_DIR/inodes" > "$TEST_DIR/got"
+    same "$*" "$TEST_DIR/got" "$TEST_DIR/expected"
+}
+
+for io in auto uring mmap stdio
+do
+    check --io $io
+done
+for hash in sha256 xxh128 blake3
+do
+    check --hash $hash -j 4
+done
+check --stages none --compare 0
+check --compare 64
+check --order inode
+check --max-memory 1M
+check --min-size 0 --max-memory 1M --hash blake3
+
+# Small buffers of many walkers cut more runs than a tiny budget merges at once, and few descriptors are left
+(ulimit -n 32 && exec $BIN -q --no-cache --format nul --max-memory 1M -j 16 $ROOTS) | groups "$TEST_DIR/inodes" > "$TEST_DIR/got"
+same "--max-memory 1M -j 16, ulimit -n 32" "$TEST_DIR/got" "$TEST_DIR/expected"
+
+# Files on a second device, here tmpfs, are hashed on a lane of their own fed alongside disk's
+LANES=/dev/shm/dupsfinder-lanes
+if [ -d /dev/shm ] && [ "$(stat -f -c %T /dev/shm)" = tmpfs ] && mkdir -p $LANES && cp -a "$TEST_DIR/modes/d0" $LANES
+then
+    inodes $ROOTS $LANES > "$TEST_DIR/lanes.inodes"
+    reference "$TEST_DIR/lanes.inodes" $ROOTS $LANES > "$TEST_DIR/lanes.expected"
+    for order in none inode
+    do
+        $BIN -q --no-cache --format nul --order $order -j 4 $ROOTS $LANES | groups "$TEST_DIR/lanes.inodes" > "$TEST_DIR/got"
+        same "two devices --order $order" "$TEST_DIR/got" "$TEST_DIR/lanes.expected"
+    done
+    rm -rf $LANES
+else
+    echo "skip    two devices, no tmpfs at /dev/shm"
+fi
+
+# A second run takes digests from hash cache written by first one
+rm -f "$TEST_DIR/cache"
+for run in cold warm
+do
+    $BIN -q --cache "$TEST_DIR/cache" --format nul $ROOTS | groups "$TEST_DIR/inodes" > "$TEST_DIR/got"
+    same "--cache ($run)" "$TEST_DIR/got" "$TEST_DIR/expected"
+done
+
+exit $failures
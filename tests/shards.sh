@@ -0,0 +1,61 @@
+#!/bin/sh
+# Checks sharded scanning: separate processes index parts of a tree, a merge asks them for digests, they compute
+# them, and a second merge finds same groups as sha256sum does over whole tree
+
+. tests/lib.sh
+set -e
+tree modes -n 4000 --max-size 262144 --dup 0.2 --header 0.1 --links 0.02
+tree large -n 40 --min-size 1048576 --max-size 33554432 --dup 0.3 --header 0.3 --depth 1
+inodes "$TEST_DIR/modes" "$TEST_DIR/large" > "$TEST_DIR/inodes"
+reference "$TEST_DIR/inodes" "$TEST_DIR/modes" "$TEST_DIR/large" > "$TEST_DIR/expected"
+set +e
+
+# One shard per subdirectory, one for files lying directly in root, and one overlapping another
+shards="$TEST_DIR/shards"
+rm -rf "$shards"
+mkdir -p "$shards"
+n=0
+for part in "$TEST_DIR"/modes/d* "$TEST_DIR/large" "$TEST_DIR/modes/d0"
+do
+    $BIN -q --no-cache --shard-index "$shards/$n.idx" "$part" &
+    n=$((n + 1))
+done
+$BIN -q --no-cache --shard-index "$shards/root.idx" $(find "$TEST_DIR/modes" -maxdepth 1 -type f) &
+wait
+indexes=$(ls "$shards"/*.idx)
+
+$BIN --merge --format nul --stats-json "$shards/stats.json" $indexes > /dev/null 2> "$shards/log"
+status=$?
+wants=$(ls "$shards"/*.want 2> /dev/null | wc -l)
+if [ $status = 2 ] && [ "$wants" -gt 0 ] && [ -s "$shards/stats.json" ]
+then
+    echo "ok      merge asks $wants shards for digests"
+else
+    echo "FAILED  merge asks for digests (status $status, $wants requests)"
+    failures=$((failures + 1))
+fi
+
+# A file changed before its shard hashes it is left out, like sha256sum no longer sees it as a copy
+changed=$(head -1 "$TEST_DIR/expected" | cut -d, -f1)
+changed=$(awk -v node="$changed" '$2 == node { print $1; exit }' "$TEST_DIR/inodes")
+echo changed >> "$changed"
+inodes "$TEST_DIR/modes" "$TEST_DIR/large" > "$TEST_DIR/inodes"
+reference "$TEST_DIR/inodes" "$TEST_DIR/modes" "$TEST_DIR/large" > "$TEST_DIR/expected"
+
+for index in $indexes
+do
+    $BIN -j 2 --shard-hash "$index" > /dev/null 2>> "$shards/log" &
+done
+wait
+
+$BIN --merge --format nul $indexes | groups "$TEST_DIR/inodes" > "$TEST_DIR/got"
+same "merge after --shard-hash" "$TEST_DIR/got" "$TEST_DIR/expected"
+if ls "$shards"/*.want > /dev/null 2>&1
+then
+    echo "FAILED  requests left after --shard-hash"
+    failures=$((failures + 1))
+fi
+
+# Generated tree is shared with other scripts, so it is restored as it was
+truncate -s -8 "$changed"
+exit $failures
@@ -0,0 +1,389 @@
+// GNU extensions, for syscall()
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "stats.h"
+#include "uring.h"
+
+// Bytes read per request when hashing whole files
+#define CHUNK (128 * 1024)
+
+// Submission and completion rings shared with kernel
+typedef struct ring
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned pending;
+} ring;
+
+// Steps a file goes through while in flight
+typedef enum state
+{
+    FREE,
+    OPENING,
+    READING,
+    CLOSING
+} state;
+
+// A file in flight, at most one request of a slot is queued at any time
+typedef struct slot
+{
+    uring_job *job;
+    state step;
+    int fd;
+
+    // Position of queued request in submission ring, tells whether kernel took it
+    unsigned sequence;
+    hash_stream stream;
+    unsigned char *buffer;
+} slot;
+
+static bool ring_open(ring *r, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(r, 0, sizeof(ring));
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (r->fd < 0)
+        return false;
+
+    r->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_size > r->sq_size)
+            r->sq_size = r->cq_size;
+        r->cq_size = r->sq_size;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+    {
+        close(r->fd);
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->cq_ptr = r->sq_ptr;
+    }
+    else
+    {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+        {
+            munmap(r->sq_ptr, r->sq_size);
+            close(r->fd);
+            return false;
+        }
+    }
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        if (r->cq_ptr != r->sq_ptr)
+            munmap(r->cq_ptr, r->cq_size);
+        munmap(r->sq_ptr, r->sq_size);
+        close(r->fd);
+        return false;
+    }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static void ring_close(ring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+}
+
+// Returns a cleared submission entry, made visible to kernel by next ring_enter()
+static struct io_uring_sqe *ring_sqe(ring *r)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++r->pending;
+    return sqe;
+}
+
+// Submits queued entries and waits for at least one completion
+static bool ring_enter(ring *r)
+{
+    while (true)
+    {
+        int submitted = syscall(__NR_io_uring_enter, r->fd, r->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted >= 0)
+        {
+            r->pending -= submitted;
+            return true;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return false;
+    }
+}
+
+static void queue_read(ring *r, slot *s, unsigned id, off_t offset, size_t size)
+{
+    s->sequence = *r->sq_tail;
+    struct io_uring_sqe *sqe = ring_sqe(r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long)s->buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = id;
+    s->step = READING;
+}
+
+static void queue_close(ring *r, slot *s, unsigned id)
+{
+    s->sequence = *r->sq_tail;
+    struct io_uring_sqe *sqe = ring_sqe(r);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = s->fd;
+    sqe->user_data = id;
+    s->step = CLOSING;
+}
+
+// Reads next range stream wants, or finishes file once it wants nothing more
+static void queue_next(ring *r, slot *s, unsigned id, unsigned chunk)
+{
+    off_t offset;
+    size_t size;
+    if (stream_want(&s->stream, &offset, &size))
+    {
+        queue_read(r, s, id, offset, size < chunk ? size : chunk);
+        return;
+    }
+    stream_final(&s->stream, s->job->hash);
+    s->job->result = 0;
+    queue_close(r, s, id);
+}
+
+// Moves a slot to its next step once its queued request completes
+static void advance(ring *r, slot *slots, unsigned id, int res, unsigned chunk, unsigned *active)
+{
+    slot *s = &slots[id];
+    switch (s->step)
+    {
+        case OPENING:
+            stats_open(res < 0 ? -res : 0);
+            if (res < 0)
+            {
+                fprintf(stderr, "Unable to open file %s\n", s->job->path);
+                s->job->result = -res;
+                s->step = FREE;
+                --*active;
+                break;
+            }
+            s->fd = res;
+            stream_init(&s->stream, s->job->kind, s->job->partial, s->job->engine, s->job->size);
+            queue_next(r, s, id, chunk);
+            break;
+
+        case READING:
+            if (res < 0)
+            {
+                stats_error();
+                fprintf(stderr, "Unable to read file %s\n", s->job->path);
+                s->job->result = -res;
+                queue_close(r, s, id);
+                break;
+            }
+            stats_read(res);
+            stream_update(&s->stream, s->buffer, res);
+            queue_next(r, s, id, chunk);
+            break;
+
+        case CLOSING:
+            s->step = FREE;
+            --*active;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Settles slots once ring takes no more requests, waiting for those kernel already took, so that only slots
+// left READING or CLOSING still own a descriptor
+static void abandon(ring *r, slot *slots, unsigned depth)
+{
+    unsigned taken = 0, head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < depth; ++i)
+        if (slots[i].step != FREE && (int)(slots[i].sequence - head) < 0)
+            ++taken;
+
+    while (taken)
+    {
+        unsigned cq = *r->cq_head;
+        while (cq != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &r->cqes[cq & *r->cq_mask];
+            slot *s = &slots[cqe->user_data];
+            if (s->step == OPENING && cqe->res >= 0)
+            {
+                s->fd = cqe->res;
+                s->step = READING;
+            }
+            else if (s->step != READING)
+            {
+                s->step = FREE;
+            }
+            s->sequence = *r->sq_tail;
+            --taken;
+            ++cq;
+        }
+        __atomic_store_n(r->cq_head, cq, __ATOMIC_RELEASE);
+        if (taken && syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            break;
+    }
+
+    // Kernel may still finish what it took, a descriptor it may have opened or closed is left alone
+    head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < depth; ++i)
+        if (slots[i].step == OPENING || (slots[i].step == CLOSING && (int)(slots[i].sequence - head) < 0))
+            slots[i].step = FREE;
+}
+
+bool uring_available(void)
+{
+    static int available = -1;
+    if (available != -1)
+        return available;
+
+    available = false;
+    ring r;
+    if (!ring_open(&r, 2))
+        return false;
+
+    // Open, read and close requests came with different kernel versions
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (probe && syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        const int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+        available = true;
+        for (int i = 0; i < 3; ++i)
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+                available = false;
+    }
+    free(probe);
+    ring_close(&r);
+    return available;
+}
+
+bool uring_hash(uring_job *jobs, size_t count, unsigned depth)
+{
+    if (!count)
+        return true;
+    if (depth > count)
+        depth = count;
+
+    // Whole files are read in big chunks, partial stages a block at a time
+    unsigned chunk = STAGE_BLOCK;
+    for (size_t i = 0; i < count; ++i)
+        if (jobs[i].kind == STREAM_DIGEST)
+            chunk = CHUNK;
+
+    ring r;
+    if (!ring_open(&r, depth))
+        return false;
+
+    // Streams hold engine state, which needs more alignment than calloc() gives
+    slot *slots = aligned_alloc(_Alignof(slot), depth * sizeof(slot));
+    unsigned char *buffers = malloc((size_t)depth * chunk);
+    if (!slots || !buffers)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        free(slots);
+        free(buffers);
+        ring_close(&r);
+        return false;
+    }
+    memset(slots, 0, depth * sizeof(slot));
+    for (unsigned i = 0; i < depth; ++i)
+        slots[i].buffer = buffers + (size_t)i * chunk;
+
+    size_t next = 0;
+    unsigned active = 0;
+    bool success = true;
+    while (next < count || active)
+    {
+        // Fills free slots with new files
+        for (unsigned i = 0; i < depth && next < count; ++i)
+        {
+            if (slots[i].step != FREE)
+                continue;
+            slots[i].job = &jobs[next++];
+            slots[i].job->result = EIO;
+            slots[i].step = OPENING;
+            ++active;
+
+            slots[i].sequence = *r.sq_tail;
+            struct io_uring_sqe *sqe = ring_sqe(&r);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long)slots[i].job->path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = i;
+        }
+
+        if (!ring_enter(&r))
+        {
+            abandon(&r, slots, depth);
+            success = false;
+            break;
+        }
+
+        // Reaps every completion, each one queues at most one new request
+        unsigned head = *r.cq_head;
+        while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+            advance(&r, slots, cqe->user_data, cqe->res, chunk, &active);
+            ++head;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Closing ring cancels and waits for whatever it still has, only then buffers are no longer written to
+    ring_close(&r);
+    for (unsigned i = 0; i < depth && !success; ++i)
+        if (slots[i].step == READING || slots[i].step == CLOSING)
+            close(slots[i].fd);
+    free(slots);
+    free(buffers);
+    return success;
+}
@@ -0,0 +1,36 @@
+// Contains declaration of io_uring read engine used to hash many files at once
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hashes.h"
+
+// A file to be read and hashed by uring_hash()
+typedef struct uring_job
+{
+    const char *path;
+    stream_kind kind;
+
+    // Partial stage to run for xxhash jobs, engine for whole file ones, and size of file as scanned
+    const stage *partial;
+    const engine *engine;
+    off_t size;
+
+    // Receives digest, see stream_final()
+    void *hash;
+
+    // 0 on success, error number of failed open or read otherwise
+    int result;
+} uring_job;
+
+// Tells whether kernel supports io_uring with open, read and close operations
+bool uring_available(void);
+
+// Opens, reads, hashes and closes files keeping up to depth of them in flight,
+// returns false if ring could not be set up or failed midway, jobs should then be hashed another way
+bool uring_hash(uring_job *jobs, size_t count, unsigned depth);
+
+#endif
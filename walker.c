@@ -0,0 +1,364 @@
+// GNU extensions, for syscall(), O_DIRECTORY and O_NOFOLLOW
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "filter.h"
+#include "stats.h"
+#include "walker.h"
+
+// Size of buffer handed to getdents64, enough for a few thousand entries per call
+#define DENTS_BUF (128 * 1024)
+
+// Layout of records returned by getdents64
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// A directory waiting to be read, with what enter_fn returned for it and device of root it was found under
+typedef struct pending_dir
+{
+    char *path;
+    void *context;
+    dev_t dev;
+} pending_dir;
+
+// Double ended queue of directories owned by one worker
+typedef struct deque
+{
+    pthread_mutex_t lock;
+    pending_dir *dirs;
+    size_t head, tail, capacity;
+} deque;
+
+static deque *queues;
+static int workers;
+static enter_fn enterDir;
+static walk_fn callback;
+
+// Directories queued or being read, walk is over when it drops to zero
+static atomic_long pending;
+
+// Directories sitting in queues, tells idle workers whether to look for work
+static atomic_long queued;
+
+// Set when a callback fails so that every worker stops
+static atomic_bool failed;
+
+// Idle workers sleep here until new directories are queued or walk ends
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int sleepers;
+
+static bool enqueue(int id, pending_dir dir)
+{
+    deque *q = &queues[id];
+    atomic_fetch_add(&pending, 1);
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head == q->capacity)
+    {
+        // Grows ring buffer and unwraps it to the start
+        size_t capacity = q->capacity ? q->capacity * 2 : 64;
+        pending_dir *dirs = malloc(capacity * sizeof(pending_dir));
+        if (!dirs)
+        {
+            pthread_mutex_unlock(&q->lock);
+            atomic_fetch_sub(&pending, 1);
+            fprintf(stderr, "Not enough memory!\n");
+            return false;
+        }
+        for (size_t i = q->head; i < q->tail; ++i)
+            dirs[i - q->head] = q->dirs[i % q->capacity];
+        q->tail -= q->head;
+        q->head = 0;
+        free(q->dirs);
+        q->dirs = dirs;
+        q->capacity = capacity;
+    }
+    q->dirs[q->tail++ % q->capacity] = dir;
+    pthread_mutex_unlock(&q->lock);
+
+    // Wakes an idle worker, if any, to steal the new directory
+    atomic_fetch_add(&queued, 1);
+    if (atomic_load(&sleepers))
+    {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    return true;
+}
+
+// Owner takes newest directory, going depth first keeps its working set small
+static bool take(int id, pending_dir *dir)
+{
+    deque *q = &queues[id];
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail != q->head)
+    {
+        *dir = q->dirs[--q->tail % q->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (found)
+        atomic_fetch_sub(&queued, 1);
+    return found;
+}
+
+// Thieves take oldest directory, which tends to be the root of a big subtree
+static bool steal(int id, pending_dir *dir)
+{
+    for (int i = 1; i < workers; ++i)
+    {
+        deque *q = &queues[(id + i) % workers];
+        bool found = false;
+        pthread_mutex_lock(&q->lock);
+        if (q->tail != q->head)
+        {
+            *dir = q->dirs[q->head++ % q->capacity];
+            found = true;
+        }
+        pthread_mutex_unlock(&q->lock);
+        if (found)
+        {
+            atomic_fetch_sub(&queued, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Marks a directory as done and wakes everyone once whole tree is walked
+static void finish(void)
+{
+    if (atomic_fetch_sub(&pending, 1) == 1)
+    {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_broadcast(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+static char *join(const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    char *path = malloc(dlen + nlen + 2);
+    if (!path)
+        return NULL;
+    memcpy(path, dir, dlen);
+    if (dlen && dir[dlen - 1] != '/')
+        path[dlen++] = '/';
+    memcpy(path + dlen, name, nlen + 1);
+    return path;
+}
+
+static void readDir(int id, pending_dir dir, char *buffer)
+{
+    int fd = open(dir.path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    stats_open(fd == -1 ? errno : 0);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Unable to read %s\n", dir.path);
+        return;
+    }
+
+    long bytes;
+    while ((bytes = syscall(SYS_getdents64, fd, buffer, DENTS_BUF)) > 0)
+    {
+        for (long pos = 0; pos < bytes && !atomic_load(&failed);)
+        {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+                continue;
+
+            // Symbolic links, sockets, fifos and devices are never loaded
+            unsigned char type = entry->d_type;
+            if (type != DT_DIR && type != DT_REG && type != DT_UNKNOWN)
+                continue;
+
+            // Device of a directory is only needed to stay on one filesystem
+            struct stat sb;
+            if (type != DT_DIR || filters.oneFilesystem)
+            {
+                if (fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+                    continue;
+                if (S_ISDIR(sb.st_mode))
+                    type = DT_DIR;
+                else if (!S_ISREG(sb.st_mode))
+                    continue;
+            }
+
+            if (type == DT_DIR)
+            {
+                // Excluded directories and other filesystems are pruned before anything below them is read
+                if (!filter_dir(dir.path, name) || (filters.oneFilesystem && sb.st_dev != dir.dev))
+                    continue;
+
+                // Only directories need a path of their own, to be opened
+                pending_dir sub = {join(dir.path, name), enterDir(dir.context, name), dir.dev};
+                if (!sub.path || !sub.context || !enqueue(id, sub))
+                {
+                    if (!sub.path || !sub.context)
+                        fprintf(stderr, "Not enough memory!\n");
+                    free(sub.path);
+                    atomic_store(&failed, true);
+                    break;
+                }
+            }
+            else if (filter_file(dir.path, name, &sb) && !callback(dir.context, name, &sb))
+            {
+                atomic_store(&failed, true);
+            }
+        }
+        if (atomic_load(&failed))
+            break;
+    }
+    if (bytes == -1)
+    {
+        stats_error();
+        fprintf(stderr, "Unable to read %s\n", dir.path);
+    }
+
+    close(fd);
+}
+
+static void *worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+
+    char *buffer = malloc(DENTS_BUF);
+    if (!buffer)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        atomic_store(&failed, true);
+    }
+
+    while (true)
+    {
+        pending_dir dir;
+        if (take(id, &dir) || steal(id, &dir))
+        {
+            if (buffer && !atomic_load(&failed))
+                readDir(id, dir, buffer);
+            free(dir.path);
+            finish();
+            continue;
+        }
+
+        // Nothing to steal, waits until more directories are queued or walk ends
+        pthread_mutex_lock(&idle_lock);
+        atomic_fetch_add(&sleepers, 1);
+        while (!atomic_load(&queued) && atomic_load(&pending))
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        atomic_fetch_sub(&sleepers, 1);
+        bool done = !atomic_load(&pending);
+        pthread_mutex_unlock(&idle_lock);
+        if (done)
+            break;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+bool walk(char **roots, int count, int threads, enter_fn enter, walk_fn fn)
+{
+    workers = threads > 0 ? threads : 1;
+    enterDir = enter;
+    callback = fn;
+    atomic_store(&pending, 0);
+    atomic_store(&queued, 0);
+    atomic_store(&failed, false);
+
+    queues = calloc(workers, sizeof(deque));
+    if (!queues)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        return false;
+    }
+    for (int i = 0; i < workers; ++i)
+        pthread_mutex_init(&queues[i].lock, NULL);
+
+    // Roots are spread over workers, plain files given as roots are loaded directly
+    bool success = true;
+    for (int i = 0, next = 0; i < count && success; ++i)
+    {
+        struct stat sb;
+        if (lstat(roots[i], &sb) == -1)
+        {
+            fprintf(stderr, "Unable to read %s\n", roots[i]);
+            success = false;
+        }
+        else if (S_ISDIR(sb.st_mode))
+        {
+            pending_dir dir = {strdup(roots[i]), enter(NULL, roots[i]), sb.st_dev};
+            if (!dir.path || !dir.context || !enqueue(next++ % workers, dir))
+            {
+                if (!dir.path || !dir.context)
+                    fprintf(stderr, "Not enough memory!\n");
+                free(dir.path);
+                success = false;
+            }
+        }
+        else if (S_ISREG(sb.st_mode) && filter_file(NULL, roots[i], &sb))
+        {
+            success = fn(NULL, roots[i], &sb);
+        }
+    }
+
+    pthread_t *tids = malloc(workers * sizeof(pthread_t));
+    if (!tids)
+    {
+        fprintf(stderr, "Not enough memory!\n");
+        success = false;
+    }
+
+    int started = 0;
+    if (success)
+    {
+        for (; started < workers; ++started)
+            if (pthread_create(&tids[started], NULL, worker, (void *)(intptr_t)started))
+                break;
+
+        // Runs walk on the calling thread if no worker could be started
+        if (!started)
+            worker(0);
+    }
+    for (int i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+    free(tids);
+
+    // Releases directories left behind after a failure
+    for (int i = 0; i < workers; ++i)
+    {
+        for (size_t j = queues[i].head; j < queues[i].tail; ++j)
+            free(queues[i].dirs[j % queues[i].capacity].path);
+        free(queues[i].dirs);
+        pthread_mutex_destroy(&queues[i].lock);
+    }
+    free(queues);
+    queues = NULL;
+
+    return success && !atomic_load(&failed);
+}
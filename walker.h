@@ -0,0 +1,22 @@
+// Contains declaration of the parallel directory walker used by search()
+
+#ifndef WALKER_H
+#define WALKER_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+// Called from worker threads for every directory found, before any of its entries, with what it returned
+// for parent directory, NULL for roots. Returns what its entries are handed, NULL when out of memory.
+// Must be thread safe.
+typedef void *(*enter_fn)(void *parent, const char *name);
+
+// Called from worker threads for every regular file found, with what enter_fn returned for its directory,
+// a plain file given as root comes with NULL and its whole path as name. Must be thread safe.
+typedef bool (*walk_fn)(void *dir, const char *name, const struct stat *sb);
+
+// Walks all roots at once with given no of threads, never follows symbolic links, skips files filters reject and
+// never reads directories they exclude
+bool walk(char **roots, int count, int threads, enter_fn enter, walk_fn fn);
+
+#endif